@@ -0,0 +1,13 @@
+# parameters named like the C locals of a memoized function's wrapper
+# run with: ./runml --memoize memoize.ml, it should print -15.083333 twice and then 39
+function area key value
+	a <- key * value + key * key - value * value + key / value
+	b <- a * key - value * a + a / key + value * value * key
+	return a + b - key * value * a + value
+function mix first slot probe memcmp memcpy
+	a <- first * slot + probe * memcmp - memcpy * first + slot / memcpy
+	b <- a * probe - slot * a + memcmp / first + memcpy * memcpy
+	return b - a * first + probe - memcmp * memcpy + slot * 0
+print area(3, 4)
+print area(3, 4)
+print mix(1, 2, 3, 4, 8)
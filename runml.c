@@ -3,20 +3,33 @@
 //  Student2:   24000895   Alexandra Mennie
 //  Platform:   Linux  
 
+// needed for mmap() and friends when compiling with -std=c11
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
 #include <string.h>
-#include <ctype.h>
 #include <math.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h> // parallel lexing, part of libc on current glibc (older ones want -pthread)
+#include <stdatomic.h>
+
+// vector fast paths for skipping comments and blanks in the lexer
+#if defined(__GNUC__) && defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__GNUC__) && defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
-// defining array size to take in .ml lines
-#define MY_SIZE 1000
-#define MAX_NODES 1000
 
 // initalise different token types for our lexer, values described in comments
 typedef enum { 
@@ -34,13 +47,18 @@ typedef enum {
     TknLBracket, // "(" 
     TknRBracket, // ")"
     TknComma, // ","
+    TknError, // a lexing error found by a --jobs worker, reported when the parser gets to it
     TknEnd // "END" 
 } TknType;
 
-// define structure for "Token" as a 'type' and 'value' pair
+// define structure for "Token" as a 'type' and a view into the source buffer
+// the value is never copied, a token just remembers where its lexeme starts and how long it is
+// kept at 16 bytes so the parser can walk the token stream without dragging lexemes through the cache
 typedef struct { 
     TknType type;
-    char value[100]; } // size set as 100 as we shouldn't encounter a value more than 100 bytes long  
+    uint32_t offset; // position of the first character of the lexeme in Source
+    uint32_t length; // number of characters in the lexeme
+    int32_t id; } // interned id of the lexeme, 0 if it has none
 Token;
 
 // node types for AST 
@@ -69,8 +87,8 @@ typedef struct AstNode {
 
                 // func def node
         struct {
-            char *identifier;
-            char** params; // array of parameter names
+            int32_t identifier; // symbol id of the function name
+            int32_t* params; // array of parameter symbol ids
             int paramCount;
             struct AstNode **stmt; // array of statment nodes
             int stmtCount;
@@ -85,7 +103,7 @@ typedef struct AstNode {
             union {
                 struct {
                     struct AstNode *exp; // For assignment statements
-                    char *identifier; // Variable name
+                    int32_t identifier; // Variable symbol id
                 } assignment;
 
                 struct {
@@ -95,47 +113,43 @@ typedef struct AstNode {
                 struct {
                     struct AstNode *exp; // For return statements
                 } returnStmt;
-
-                struct {
-                    char* identifier;
-                    struct AstNode **args;
-                    int argCount;
-                } funcCall;
             } data;
         } stmt;
         
         // expression node
         struct {
             struct AstNode *lVar; // 
-            char *oper; // + or -
+            const char *oper; // + or - (points at a string literal, never freed)
             struct AstNode *rVar;
         } Expression;
         
         // term node
         struct {
             struct AstNode *lVar;
-            char *oper; // x or /
+            const char *oper; // x or / (points at a string literal, never freed)
             struct AstNode *rVar;
         } term;
         
         // factor node
         struct {
-            float constant; // using float as we only require 6 digits of prec
-            char* identifier;
+            double constant; // exactly what the literal says, rounded once
+            uint32_t literal; // offset of the literal's lexeme in Source, so codegen can write out what was written
+            int32_t identifier; // variable symbol id, 0 if the factor isn't a variable
             struct AstNode *funcCall;
             struct AstNode *exp; // expressions in parentheses
         } factor;
 
         // func call node
         struct {
-            char* identifier;
+            int32_t identifier; // symbol id of the function being called
             struct AstNode **args;
             int argCount;
+            bool isStatement; // called on a line of its own, so there's no result to use
         } funcCall;
         
         // assignment node
         struct {
-            char* identifier; // var
+            int32_t identifier; // var symbol id
             struct AstNode *exp;
         } assignment;
         
@@ -151,40 +165,431 @@ typedef struct AstNode {
     } data;
 } AstNode;
 
+// ------------------------------------------- MEMORY HELPERS ---------------------------------------- //
+
+// realloc that gives up on failure, there's nothing sensible to do without the memory
+void* resizeArray(void *array, size_t count, size_t elementSize) {
+    void *newArray = realloc(array, elementSize * count);
+    if (!newArray) {
+        fprintf(stderr, "@ Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    return newArray;
+}
+
+// calloc that gives up the same way, for the per-pass tables that have to start out zeroed
+void* zeroedArray(size_t count, size_t elementSize) {
+    void *array = calloc(count ? count : 1, elementSize);
+    if (!array) {
+        fprintf(stderr, "@ Error: Memory allocation failed.\n");
+        exit(1);
+    }
+    return array;
+}
+
+// make sure a growable array has room for needed elements, doubling its capacity as required
+void* growArray(void *array, int *capacity, int needed, size_t elementSize) {
+    if (needed <= *capacity) {
+        return array;
+    }
+    int newCapacity = *capacity ? *capacity : 64;
+    while (newCapacity < needed) {
+        newCapacity *= 2;
+    }
+    *capacity = newCapacity;
+    return resizeArray(array, newCapacity, elementSize);
+}
+
+// ------------------------------------------- ARENA ALLOCATOR -------------------------------------- //
+
+// everything the compiler builds (symbol names, AST nodes, argument and statement lists) is bump allocated
+// out of big chunks and thrown away in one go by arenaFree() at the end, rather than malloc'd piece by piece
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+typedef struct ArenaChunk {
+    struct ArenaChunk *next; // previous chunk, we only ever allocate from the newest one
+    size_t used; // bytes handed out from data so far
+    size_t size; // bytes available in data
+    max_align_t data[]; // max_align_t so anything we hand out is suitably aligned
+} ArenaChunk;
+
+typedef struct {
+    ArenaChunk *head;
+} Arena;
+
+Arena CompileArena; // the one arena everything goes in
+
+// hand out size bytes of zeroed memory
+void* arenaAlloc(Arena *arena, size_t size) {
+    size = (size + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1); // keep the next allocation aligned
+    ArenaChunk *chunk = arena->head;
+    if (!chunk || chunk->size - chunk->used < size) { // current chunk is full, start a new one
+        size_t chunkSize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+        chunk = resizeArray(NULL, 1, sizeof(ArenaChunk) + chunkSize);
+        chunk->next = arena->head;
+        chunk->used = 0;
+        chunk->size = chunkSize;
+        arena->head = chunk;
+    }
+    void *memory = (char*)chunk->data + chunk->used;
+    chunk->used += size;
+    memset(memory, 0, size);
+    return memory;
+}
+
+// copy something into the arena
+void* arenaCopy(Arena *arena, const void *source, size_t size) {
+    if (size == 0) {
+        return NULL;
+    }
+    void *memory = arenaAlloc(arena, size);
+    memcpy(memory, source, size);
+    return memory;
+}
+
+// give every chunk back at once
+void arenaFree(Arena *arena) {
+    ArenaChunk *chunk = arena->head;
+    while (chunk) {
+        ArenaChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    arena->head = NULL;
+}
+
 // ###################################### TOKENISATION START ######################################
 
+// the whole .ml file lives in this buffer, tokens are (offset, length) views into it
+const char *Source = NULL; // mapped (or read) contents of the .ml file
+size_t SourceLength = 0; // number of bytes in Source
+bool SourceMapped = false; // true if Source came from mmap() rather than malloc()
+
+// get a pointer to the first character of a token's lexeme (NOT null-terminated)
+const char* tknText(const Token *token) {
+    return Source + token->offset;
+}
+
+// how an error message names a token: quoted, unless quoting it would break the message over lines or
+// quote nothing at all. the text lasts until the next call
+const char* tknDescription(const Token *token) {
+    static char text[48];
+    switch (token->type) {
+        case TknNewline:
+            return "end of line";
+        case TknTab:
+            return "indentation";
+        case TknEnd:
+            return "end of file";
+        default:
+            snprintf(text, sizeof text, "'%.*s'", token->length > 40 ? 40 : (int)token->length, tknText(token));
+            return text;
+    }
+}
+
+// ------------------------------------------- DIAGNOSTICS -------------------------------------- //
+
+// every syntax error goes through syntaxError(). normally the first one ends the program, but with --check we
+// keep going and report every error in the file: the lexer throws the bad line away and the parser jumps back to
+// the start of the statement it was in (see ParseCheckpoint) and carries on from the next line
+bool CheckMode = false; // --check, stop after parsing and report every error
+const char *SourceName = NULL; // name of the .ml file, for error locations
+int SyntaxErrorCount = 0;
+
+// where the parser picks up again after an error in --check mode, one for each statement being parsed.
+// remembers how deep the parser's stacks were so anything the broken statement left on them can be dropped
+typedef struct {
+    jmp_buf jump;
+    int scratchCount;
+    int operCount;
+    int32_t function;
+} ParseCheckpoint;
+
+ParseCheckpoint *Checkpoint = NULL; // innermost checkpoint, NULL while lexing
+
+// line number (from 1) of a position in Source, only worked out when there's an error to report. it counts on
+// from the last position asked about (or back, the parser can report a token the lexer has already gone past),
+// and errors come in file order, so --check goes over the file about once however many errors there are
+size_t LineOffset = 0; // position the last line number was worked out for
+unsigned LineNumber = 1; // the line it's on
+
+unsigned countNewlines(const char *pointer, const char *end) {
+    unsigned count = 0;
+    while ((pointer = memchr(pointer, '\n', end - pointer))) {
+        count++;
+        pointer++;
+    }
+    return count;
+}
+
+unsigned sourceLine(size_t offset) {
+    if (offset >= LineOffset) {
+        LineNumber += countNewlines(Source + LineOffset, Source + offset);
+    } else {
+        LineNumber -= countNewlines(Source + offset, Source + LineOffset);
+    }
+    LineOffset = offset;
+    return LineNumber;
+}
+
+// report a syntax error at offset in Source. exits unless we're in --check mode, where it returns to the
+// lexer or jumps back to the parser's checkpoint
+void syntaxError(size_t offset, const char *format, ...) {
+    SyntaxErrorCount++;
+    if (CheckMode) {
+        fprintf(stderr, "! %s:%u: ", SourceName, sourceLine(offset));
+    } else {
+        fprintf(stderr, "! ");
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+
+    if (!CheckMode) {
+        exit(EXIT_FAILURE);
+    }
+    if (Checkpoint) {
+        longjmp(Checkpoint->jump, 1);
+    }
+}
+
 // FOR TESTING PURPOSES - print the token
-void print_token(Token token) {
-    printf("Token Type: %d, Value: %s\n", token.type, token.value);
+void print_token(const Token *token) {
+    printf("Token Type: %d, Value: %.*s\n", token->type, (int)token->length, tknText(token));
+}
+
+// powers of ten that are exact as doubles (10^23 isn't)
+const double ExactPowersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// convert a TknNumber/TknFloat lexeme (digits, then optionally '.' and more digits) to the nearest double
+// nearly every literal has at most 15 or so significant digits and 22 decimal places, then the digits as an
+// integer and the power of ten are both exact doubles and one IEEE division rounds correctly (Clinger's fast path).
+// anything longer goes to strtod(), which also rounds correctly
+double tknToDouble(const Token *token) {
+    const char *text = tknText(token);
+    uint64_t mantissa = 0;
+    int digits = 0; // significant digits so far, leading zeros don't count
+    int places = 0; // digits after the decimal point
+    bool afterPoint = false;
+    for (uint32_t i = 0; i < token->length && digits <= 19; i++) {
+        if (text[i] == '.') {
+            afterPoint = true;
+            continue;
+        }
+        places += afterPoint;
+        if (mantissa == 0 && text[i] == '0') {
+            continue;
+        }
+        digits++;
+        mantissa = mantissa * 10 + (uint64_t)(text[i] - '0');
+    }
+    if (digits <= 19 && mantissa <= (UINT64_C(1) << 53) && places <= 22) {
+        return (double)mantissa / ExactPowersOfTen[places];
+    }
+
+    // the lexer only lets an operator, bracket, comma or blank follow a number, none of which strtod() would take
+    // as part of it, so it can read straight out of Source unless the number is the very last thing in the file
+    if (token->offset + token->length < SourceLength) {
+        return strtod(text, NULL);
+    }
+    char number[512];
+    if (token->length < sizeof(number)) {
+        memcpy(number, text, token->length);
+        number[token->length] = '\0';
+        return strtod(number, NULL);
+    }
+    char *copy = resizeArray(NULL, token->length + 1, 1); // a last line of hundreds of digits, not worth avoiding
+    memcpy(copy, text, token->length);
+    copy[token->length] = '\0';
+    double value = strtod(copy, NULL);
+    free(copy);
+    return value;
+}
+
+// fill in a token, start points somewhere inside Source
+void setToken(Token *token, TknType type, const char *start, size_t length) { 
+    token->type = type; // sets type
+    token->offset = start - Source; // sets value as a view into the source
+    token->length = length;
+    token->id = 0;
 }
 
+// ------------------------------------------- SYMBOL TABLE -------------------------------------- //
+
+// every distinct identifier is interned the first time the lexer sees it and gets a small dense id (1, 2, 3...)
+// from then on the parser and code generator only ever deal with ids, id 0 means "no symbol"
+typedef struct {
+    const char *name; // null-terminated copy of the name, lives in the arena so codegen can use it directly
+    uint32_t length; // length of the name
+    uint32_t hash; // cached so growing the hash table doesn't rehash every name
+    int32_t function; // index of the name's entry in Functions, 0 if it isn't a function
+    uint8_t type; // ValueType of the values the name holds as a variable or parameter, worked out by inferTypes()
+} Symbol;
+
+Symbol *Symbols = NULL; // indexed by id, Symbols[0] is unused
+int SymbolCount = 0; // ids handed out so far
+int SymbolCapacity = 0;
+
+int32_t *SymbolHash = NULL; // open addressed hash table of ids, 0 marks an empty slot
+uint32_t SymbolHashSize = 0; // always a power of two
+
+// FNV-1a, plenty for identifiers of at most a dozen or so characters
+uint32_t hashName(const char *name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-// initalise "Tokens" array
-Token Tokens[1000]; // array that stores all tokens generated by the lexer
-int TknIndex = 0; // integer value that keeps track of our current position in array
-int TknCount = 0; // stores the number of tokens in our array
-int argsCount = 0; // store number of args called
+// get the null-terminated name of a symbol
+const char* symName(int32_t id) {
+    return Symbols[id].name;
+}
 
-// function to add tokens to our "Tokens" array
-void addToken(TknType type, const char *value) { 
-    Tokens[TknIndex].type = type; // sets type
-    strcpy(Tokens[TknIndex].value, value); // sets value 
-    TknIndex++; // increases token index/position pointer
-    TknCount++; // increment token count
+// double the hash table and put every symbol back in
+void growSymbolHash() {
+    uint32_t newSize = SymbolHashSize ? SymbolHashSize * 2 : 256;
+    int32_t *newHash = zeroedArray(newSize, sizeof(int32_t));
+    for (int32_t id = 1; id <= SymbolCount; id++) {
+        uint32_t slot = Symbols[id].hash & (newSize - 1);
+        while (newHash[slot]) {
+            slot = (slot + 1) & (newSize - 1);
+        }
+        newHash[slot] = id;
+    }
+    free(SymbolHash);
+    SymbolHash = newHash;
+    SymbolHashSize = newSize;
 }
 
-// function to check validity of identifiers
-bool isValidIdentifier(const char *str) {
-    int length = strlen(str);
-    if (length < 1 || length > 12) { // check length between 1 and 12
-        return false;
+// look a name up, adding it if it's new, and return its id
+int32_t internSymbol(const char *name, size_t length) {
+    if ((uint32_t)(SymbolCount + 1) * 2 > SymbolHashSize) { // keep the table at most half full
+        growSymbolHash();
     }
-    for (int i = 0; i < length; i++) { // check all characters are lowercase and alphabetical 
-        if (!islower(str[i]) || !isalpha(str[i])) {
-            return false;
+    uint32_t hash = hashName(name, length);
+    uint32_t slot = hash & (SymbolHashSize - 1);
+    while (SymbolHash[slot]) {
+        Symbol *symbol = &Symbols[SymbolHash[slot]];
+        if (symbol->hash == hash && symbol->length == length && memcmp(symbol->name, name, length) == 0) {
+            return SymbolHash[slot]; // seen it before
         }
+        slot = (slot + 1) & (SymbolHashSize - 1);
+    }
+
+    // new name, copy it into the arena (arenaAlloc zeroes, so it comes null-terminated)
+    char *copy = arenaAlloc(&CompileArena, length + 1);
+    memcpy(copy, name, length);
+
+    int32_t id = ++SymbolCount;
+    Symbols = growArray(Symbols, &SymbolCapacity, id + 1, sizeof(Symbol));
+    Symbols[id] = (Symbol){ .name = copy, .length = length, .hash = hash };
+    SymbolHash[slot] = id;
+    return id;
+}
+
+// give an identifier token its symbol id, interning its name on the way
+void internIdentifier(Token *token) {
+    token->id = internSymbol(tknText(token), token->length);
+}
+
+// free everything the symbol table owns (the names themselves go with the arena)
+void freeSymbols() {
+    free(Symbols);
+    free(SymbolHash);
+}
+
+// character classes used by the scanner, looked up once per byte instead of calling the
+// locale-dependent <ctype.h> functions
+#define CC_BLANK 0x01 // ' ', '\r', '\v', '\f', skipped without producing a token
+#define CC_DIGIT 0x02 // '0' to '9'
+#define CC_LOWER 0x04 // 'a' to 'z', the only characters that can start an identifier
+#define CC_WORD 0x08 // characters that keep a word going (letters, digits and '_') so bad identifiers get a proper error
+#define CC_NUMEND 0x10 // characters allowed straight after a number
+
+// what the scanner does when it sees a character at the start of a token
+typedef enum {
+    LexIllegal, // anything not listed below
+    LexBlank,
+    LexTab,
+    LexNewline,
+    LexComment, // '#'
+    LexNumber,
+    LexWord,
+    LexOperator, // single character operators, brackets and comma
+    LexAssign // '<', must be followed by '-'
+} LexAction;
+
+unsigned char CharClass[256]; // CC_ flags for every byte
+unsigned char StartAction[256]; // LexAction for every byte
+unsigned char OperatorType[256]; // TknType for the single character tokens
+
+// reserved words, looked up with a perfect hash so classifying a word costs one hash and one compare
+// the lengths of "function" (8), "print" (5), "return" (6) and "arg" (3) are all different mod 4,
+// so the bottom two bits of the length pick the only keyword a word could be
+// (if a keyword is ever added check it still lands in its own slot!)
+typedef struct {
+    const char *word;
+    size_t length;
+    TknType type; // TknEnd marks a reserved name that can't be used on its own
+} Keyword;
+
+#define KEYWORD_HASH(length) ((length) & 3)
+
+const Keyword Keywords[4] = {
+    { "function", 8, TknFunction }, // 8 & 3 == 0
+    { "print", 5, TknPrint }, // 5 & 3 == 1
+    { "return", 6, TknReturn }, // 6 & 3 == 2
+    { "arg", 3, TknEnd } // 3 & 3 == 3, reserved prefix for argN
+};
+
+// fill in the character tables, only needs doing once
+void initCharClasses() {
+    static bool done = false;
+    if (done) {
+        return;
+    }
+    done = true;
+
+    for (int c = '0'; c <= '9'; c++) {
+        CharClass[c] |= CC_DIGIT | CC_WORD;
+        StartAction[c] = LexNumber;
+    }
+    for (int c = 'a'; c <= 'z'; c++) {
+        CharClass[c] |= CC_LOWER | CC_WORD;
+        StartAction[c] = LexWord;
+    }
+    for (int c = 'A'; c <= 'Z'; c++) {
+        CharClass[c] |= CC_WORD; // uppercase can't start a word but gets swallowed into one so the error is about the identifier
+    }
+    CharClass['_'] |= CC_WORD;
+
+    const char *blanks = " \r\v\f";
+    for (const char *b = blanks; *b; b++) {
+        CharClass[(unsigned char)*b] |= CC_BLANK | CC_NUMEND;
+        StartAction[(unsigned char)*b] = LexBlank;
+    }
+    CharClass['\t'] |= CC_NUMEND;
+    CharClass['\n'] |= CC_NUMEND;
+    StartAction['\t'] = LexTab;
+    StartAction['\n'] = LexNewline;
+    StartAction['#'] = LexComment;
+    StartAction['<'] = LexAssign;
+
+    const char *operators = "+-*/(),";
+    const TknType operatorTypes[] = { TknTermOperator, TknTermOperator, TknFactorOperator, TknFactorOperator, TknLBracket, TknRBracket, TknComma };
+    for (int i = 0; operators[i]; i++) {
+        unsigned char c = operators[i];
+        CharClass[c] |= CC_NUMEND;
+        StartAction[c] = LexOperator;
+        OperatorType[c] = operatorTypes[i];
     }
-    return true;
 }
 
 int lineCount(FILE *file) {
@@ -199,567 +604,852 @@ int lineCount(FILE *file) {
     return count;
 }
 
-void tokenize(const char *code) {
-    const char *pointer = code; // accesses character in code
-    int IndentLevel = 0; // integer to track indent level
+// find the next '\n' at or after pointer, or end if there isn't one
+// comments are most of what our generated programs contain so this looks at 32 (AVX2) or 16 (SSE2) bytes at a time
+const char* findNewline(const char *pointer, const char *end) {
+#if defined(__GNUC__) && defined(__AVX2__)
+    const __m256i newlines = _mm256_set1_epi8('\n');
+    while (end - pointer >= 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)pointer), newlines));
+        if (mask) {
+            return pointer + __builtin_ctz(mask);
+        }
+        pointer += 32;
+    }
+#endif
+#if defined(__GNUC__) && defined(__SSE2__)
+    const __m128i newlines16 = _mm_set1_epi8('\n');
+    while (end - pointer >= 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)pointer), newlines16));
+        if (mask) {
+            return pointer + __builtin_ctz(mask);
+        }
+        pointer += 16;
+    }
+#endif
+    while (pointer < end && *pointer != '\n') {
+        pointer++;
+    }
+    return pointer;
+}
 
-    while (*pointer) {
+// skip a run of spaces (and the other blanks that don't produce tokens), 32 or 16 bytes at a time when we can
+const char* skipBlanks(const char *pointer, const char *end) {
+#if defined(__GNUC__) && defined(__AVX2__)
+    const __m256i spaces = _mm256_set1_epi8(' ');
+    while (end - pointer >= 32) {
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)pointer), spaces));
+        if (mask != 0xFFFFFFFFu) {
+            pointer += __builtin_ctz(~mask);
+            break;
+        }
+        pointer += 32;
+    }
+#endif
+#if defined(__GNUC__) && defined(__SSE2__)
+    const __m128i spaces16 = _mm_set1_epi8(' ');
+    while (end - pointer >= 16) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)pointer), spaces16));
+        if (mask != 0xFFFFu) {
+            pointer += __builtin_ctz(~mask & 0xFFFFu);
+            break;
+        }
+        pointer += 16;
+    }
+#endif
+    while (pointer < end && (CharClass[(unsigned char)*pointer] & CC_BLANK)) {
+        pointer++;
+    }
+    return pointer;
+}
 
-        // check for comments first (to remove them from consideration and avoid errors later on)
-        if (*pointer == '#') {
+// at the start of a line, skip any lines that are nothing but indentation and a comment
+// they produce no tokens at all, so a comment inside a function body doesn't end the body
+const char* skipCommentLines(const char *pointer, const char *end) {
+    while (pointer < end) {
+        const char *p = pointer;
+        while (p < end && (*p == '\t' || (CharClass[(unsigned char)*p] & CC_BLANK))) {
+            p++;
+        }
+        if (p == end || *p != '#') {
+            break;
+        }
+        p = findNewline(p, end);
+        pointer = p < end ? p + 1 : p; // eat the newline too
+    }
+    return pointer;
+}
 
-            // skip everything until the newline character
-            while (*pointer && *pointer != '\n') {
-                pointer++;
-            }
-            continue;  // skip until newline, negating whole comment line from tokens array
-            }
+// where the lexer has got to in Source, kept between calls so it can hand out a token at a time as the parser asks
+typedef struct {
+    const char *pointer; // next character to look at
+    const char *end; // one past the last character, the buffer is not null-terminated
+    int indentLevel; // integer to track indent level
+    bool worker; // lexing a chunk on a --jobs thread: identifiers are left for the main thread to intern,
+                 // and errors come back as TknError tokens instead of being reported out of order
+} Lexer;
+
+// skip the rest of a line with an error in it, leaving the newline for the next token. this happens before the
+// error is reported because in --check mode syntaxError() jumps straight back to the parser, and the lexer has
+// to be ready to carry on from the next line when it asks for another token
+const char* skipBadLine(Lexer *lexer, const char *pointer) {
+    lexer->pointer = findNewline(pointer, lexer->end);
+    return lexer->pointer;
+}
 
-        // check for blank spaces such as tab and newline
-        if (isspace(*pointer)) { 
-            if (*pointer == '\t') { // if tab exists
-                char TempBuffer[100]; // creates buffer to store characters, size should not exceed 100
-                sprintf(TempBuffer, "TAB%d", IndentLevel++); // string creation of value for tab token
-                addToken(TknTab, TempBuffer); // adds buffer as token
-            } 
-            else if (*pointer == '\n') { //if newline exists
-                addToken(TknNewline, "\n"); 
-                IndentLevel = 0;
-            }
-            pointer++; // loops if ' ' appears
-            continue;
-            }
+// start a lexer on length bytes of code, code must point into Source
+void initLexer(Lexer *lexer, const char *code, size_t length) {
+    initCharClasses();
+    lexer->end = code + length;
+    lexer->pointer = skipCommentLines(code, lexer->end);
+    lexer->indentLevel = 0;
+    lexer->worker = false;
+}
 
-        // check for numbers (real constant values)
-        else if (isdigit(*pointer)) { // if integer number or float (aka. realconstant) exists
-            char TempBuffer[100] = {0}; // intialises all characters in buffer to 0 
-            int i = 0; // iterator 
-            bool hasDecimalPoint = false; // needed for syntax error checking
-            
-            while (isdigit(*pointer)) { // increment and extract digits before decimal point
-                 TempBuffer[i++] = *pointer++; // 
-            }
+// the rest of a bad line has been skipped, if this is a worker hand back an error token for the main thread
+// to report rather than reporting it here. start is where the bad lexeme begins, lexing from there again finds the error
+bool deferError(Lexer *lexer, Token *token, const char *start) {
+    if (lexer->worker) {
+        setToken(token, TknError, start, 0);
+    }
+    return lexer->worker;
+}
 
-            if (*pointer == '.') { // handle floats
-                if (hasDecimalPoint) { // check for if multiple decimal points exist
-                    fprintf(stderr, "! Syntax Error: Multiple decimal points in number.\n Recommendation: Check all numbers for incorrect format.\n");
-                    exit(1);
-                }
+// produce the next token, returns false once the code has run out
+// each token starts in a state picked by StartAction[] and then runs on the CharClass[] table until it ends
+bool lexToken(Lexer *lexer, Token *token) {
+    const char *pointer = lexer->pointer; // accesses character in code
+    const char *end = lexer->end; // one past the last character, the buffer is not null-terminated
 
-                hasDecimalPoint = true;
-                TempBuffer[i++] = *pointer++; // decimal point added 
+    while (pointer < end) {
+        const char *start = pointer; // lexeme starts here, no copying needed
 
-                while (isdigit(*pointer)) { // increment and extract digits after decimal point
-                    TempBuffer[i++] = *pointer++;
-                }
-                
-                addToken(TknFloat, TempBuffer); // if float exists
+        switch ((LexAction)StartAction[(unsigned char)*pointer]) {
 
-            } else { // if number exists
-                addToken(TknNumber, TempBuffer);
-            }
+        // check for comments first (to remove them from consideration and avoid errors later on)
+        case LexComment:
+            pointer = findNewline(pointer, end); // skip until newline, negating whole comment from tokens array
+            break;
 
-            // I think this may be the better way of checking for invalid characters after a number,
-            // bc in ml its acceptable to find whitespaces after tokens -- but just double check LMAO
+        // check for blank spaces such as tab and newline
+        case LexBlank:
+            pointer = skipBlanks(pointer, end);
+            break;
 
-            if (!isspace(*pointer) && *pointer != '+' && *pointer != '-' && *pointer != '*' && *pointer != '/' && 
-            *pointer != '(' && *pointer != ')' && *pointer != ',' && *pointer != '\0') {
-                fprintf(stderr, "! Syntax Error: Invalid character '%c' after number.\nRecommendation: Ensure that numbers are followed by operators, spaces, or valid symbols.\n", *pointer);
-                exit(1);
+        case LexTab:
+            setToken(token, TknTab, pointer, 1); // indent level is implied by how many tabs precede the statement
+            lexer->indentLevel++;
+            lexer->pointer = pointer + 1;
+            return true;
+
+        case LexNewline:
+            setToken(token, TknNewline, pointer, 1); 
+            lexer->indentLevel = 0;
+            lexer->pointer = skipCommentLines(pointer + 1, end);
+            return true;
+
+        // check for numbers (real constant values), digits then optionally '.' and more digits
+        case LexNumber: {
+            TknType numberType = TknNumber;
+            while (pointer < end && (CharClass[(unsigned char)*pointer] & CC_DIGIT)) { // increment past digits before decimal point
+                pointer++;
+            }
+            if (pointer < end && *pointer == '.') { // handle floats
+                numberType = TknFloat;
+                pointer++; // decimal point added 
+                while (pointer < end && (CharClass[(unsigned char)*pointer] & CC_DIGIT)) { // increment past digits after decimal point
+                    pointer++;
+                }
             }
 
+            // in ml its acceptable to find whitespace, operators, brackets and commas after numbers, nothing else
+            // (this is also what catches a second decimal point)
+            if (pointer < end && !(CharClass[(unsigned char)*pointer] & CC_NUMEND)) {
+                const char *bad = pointer;
+                pointer = skipBadLine(lexer, pointer);
+                if (deferError(lexer, token, start)) {
+                    return true;
+                }
+                syntaxError(bad - Source, "Syntax Error: Invalid character '%c' after number. Recommendation: Ensure that numbers are followed by operators, spaces, or valid symbols.\n", *bad);
+                break;
+            }
+            setToken(token, numberType, start, pointer - start);
+            lexer->pointer = pointer;
+            return true;
         }
 
-        else if (isalpha(*pointer) && islower(*pointer)) { // alphabetical lower case only
-            char TempBuffer[100] = {0};
-            int i = 0;
-            while (isalnum(*pointer)|| *pointer == '_') { // more general isalnum() allows for us to pass invalid strings into identifier checker, meaning that this specific error can be accurately flagged
-            TempBuffer[i++] = *pointer++; } 
-            TempBuffer[i] = '\0'; // Null-terminate the buffer
-
-            if (strcmp(TempBuffer, "function") == 0) { 
-                addToken(TknFunction, TempBuffer);
-            }
-            else if (strcmp(TempBuffer, "print") == 0) { 
-                addToken(TknPrint, TempBuffer);
-            } 
-            else if (strcmp(TempBuffer, "return") == 0) { 
-                addToken(TknReturn, TempBuffer);
-            } else if (strcmp(TempBuffer, "arg") == 0) { 
+        case LexWord: { // alphabetical lower case only
+            // one pass over the word works out everything we need to classify it:
+            // how many lower case letters it starts with and whether everything after them is a digit (for argN)
+            size_t letters = 0;
+            bool digitTail = true;
+            while (pointer < end) {
+                unsigned char class = CharClass[(unsigned char)*pointer];
+                if (!(class & CC_WORD)) { // swallowing all word characters lets us flag bad identifiers accurately
+                    break;
+                }
+                if ((class & CC_LOWER) && letters == (size_t)(pointer - start)) {
+                    letters++;
+                } else if (!(class & CC_DIGIT)) {
+                    digitTail = false;
+                }
                 pointer++;
-                if (isdigit(*pointer)) {
-                    int j = 0;
-                    char argBuffer[100] = {0};
-                    // Copy "arg"
-                    argBuffer[j++] = 'a';
-                    argBuffer[j++] = 'r';
-                    argBuffer[j++] = 'g';
-                    while (isdigit(*pointer)) {
-                        argBuffer[j++] = *pointer++;
+            } 
+            size_t length = pointer - start;
+
+            if (letters == length) { // all lower case letters, either a keyword or an identifier
+                const Keyword *keyword = &Keywords[KEYWORD_HASH(length)];
+                if (keyword->length == length && memcmp(start, keyword->word, length) == 0) {
+                    if (keyword->type == TknEnd) { // "arg" on its own
+                        pointer = skipBadLine(lexer, pointer);
+                        if (deferError(lexer, token, start)) {
+                            return true;
+                        }
+                        syntaxError(start - Source, "Syntax Error: Invalid character after 'arg' characters in code. Any variable starting with 'arg' is a reserved name for accessing command line arguments \n");
+                        break;
+                    }
+                    setToken(token, keyword->type, start, length);
+                }
+                else if (length <= 12) { // if valid identifier exists 
+                    setToken(token, TknIdentifier, start, length);
+                    if (!lexer->worker) {
+                        internIdentifier(token);
                     }
-                    addToken(TknIdentifier, argBuffer); // argument token
-                    argsCount++;
                 }
                 else {
-                    fprintf(stderr, "! Syntax Error: Invalid character after 'arg' characters in code. Any variable starting with 'arg' is a reserved name for accessing command line arguments \n");
-                    exit(1);
+                    pointer = skipBadLine(lexer, pointer);
+                    if (deferError(lexer, token, start)) {
+                        return true;
+                    }
+                    syntaxError(start - Source, "Syntax Error: Invalid characters in identifier or string. Recommendation: Ensure all characters are lower case. Identifiers should be alphabetical only and between 1 and 12 characters long. \n");
+                    break;
+                }
+            }
+            else if (letters == 3 && digitTail && memcmp(start, "arg", 3) == 0) { // argN special variable
+                setToken(token, TknIdentifier, start, length); // argument token
+                if (!lexer->worker) {
+                    internIdentifier(token);
                 }
             }
-            else if (isValidIdentifier(TempBuffer)) { // if valid identifier exists 
-                addToken(TknIdentifier, TempBuffer);
-            } 
             else { // if invalid string exists
-                fprintf(stderr, "! Syntax Error: Invalid characters in identifier or string.\n Recommendation: Ensure all characters are lower case. Identifiers should be alphabetical only and between 1 and 12 characters long. \n");
-                exit(1);
+                pointer = skipBadLine(lexer, pointer);
+                if (deferError(lexer, token, start)) {
+                    return true;
+                }
+                syntaxError(start - Source, "Syntax Error: Invalid characters in identifier or string. Recommendation: Ensure all characters are lower case. Identifiers should be alphabetical only and between 1 and 12 characters long. \n");
+                break;
             }
-            continue;
-            }             
-
-        // check for mathematical operators
-        else if (*pointer == '+' || *pointer == '-' || *pointer == '*' || *pointer == '/' || *pointer == '(' || *pointer == ')'|| *pointer == ',') { // if valid character
-            char TempBuffer[2] = {*pointer, '\0'};
-            TknType TknType;
-                switch (*pointer) {
-                    case '+':
-                    case '-':
-                        TknType = TknTermOperator;  // if '+' and '-' (term operators) exists
-                        break;
-                    case '*':
-                    case '/':
-                        TknType = TknFactorOperator;  // if '*' and '/' (factor operators) exists
-                        break;
-                    case '(':
-                        TknType = TknLBracket;
-                        break;
-                    case ')':
-                        TknType = TknRBracket;  // if '(' and ')' (brackets) exists
-                        break;
-                    case ',':
-                        TknType = TknComma;  // if ',' (comma) exists
-                        break;
-        } 
-        
-        // was missing addToken after each case, so added here
-        addToken(TknType, TempBuffer);
-        pointer++;
+            lexer->pointer = pointer;
+            return true;
+        }
+
+        // check for mathematical operators, brackets and commas
+        case LexOperator:
+            setToken(token, (TknType)OperatorType[(unsigned char)*pointer], pointer, 1);
+            lexer->pointer = pointer + 1;
+            return true;
 
         // check for assignment operator
-        } else if (*pointer == '<' && *(pointer + 1) == '-') { // if "<-" operator exists
-            addToken(TknAssignmentOperator, "<-");
-            pointer += 2;
-        }
+        case LexAssign:
+            if (pointer + 1 < end && *(pointer + 1) == '-') { // if "<-" operator exists
+                setToken(token, TknAssignmentOperator, pointer, 2);
+                lexer->pointer = pointer + 2;
+                return true;
+            }
+            // a '<' on its own is just an illegal character
+            // fall through
 
         // check for all other characters
-        else { 
-            fprintf(stderr, "! Syntax Error: Illegal character '%c' exists in file.\n Recommendation: remove invalid symbols and all uppercase to fix. \n", *pointer); // just added what character its throwing an error for 
-            exit(1);
+        case LexIllegal:
+        default: {
+            const char *bad = pointer;
+            pointer = skipBadLine(lexer, pointer);
+            if (deferError(lexer, token, start)) {
+                return true;
+            }
+            syntaxError(bad - Source, "Syntax Error: Illegal character '%c' exists in file. Recommendation: remove invalid symbols and all uppercase to fix. \n", *bad); // just added what character its throwing an error for 
+            break;
+        }
+        }
+    }
+    lexer->pointer = pointer;
+    return false;
+}
+
+// read the whole file into a malloc'd buffer, used when mmap() isn't possible (pipes, /dev/stdin etc.)
+static char* slurpFile(int fd, size_t *length) {
+    size_t capacity = 4096;
+    size_t used = 0;
+    char *buffer = malloc(capacity);
+    if (!buffer) {
+        return NULL;
+    }
+    ssize_t got;
+    while ((got = read(fd, buffer + used, capacity - used)) > 0) {
+        used += got;
+        if (used == capacity) {
+            char *bigger = realloc(buffer, capacity * 2);
+            if (!bigger) {
+                free(buffer);
+                return NULL;
+            }
+            buffer = bigger;
+            capacity *= 2;
         }
     }
+    if (got < 0) {
+        free(buffer);
+        return NULL;
+    }
+    *length = used;
+    return buffer;
 }
 
 // function to read contents of a .ml file
+// the file is mapped into memory once, tokens are lexed from the mapping as the parser asks for them and point back into it
 int readFile(const char *filename) {
 
     // opening file for reading
-    FILE *file = fopen(filename, "r");
+    SourceName = filename;
+    int fd = open(filename, O_RDONLY);
     
     // error checking: file does not exist
-    if (file == NULL) {
+    if (fd < 0) {
         fprintf(stderr, "@ Error: Could not open file %s\n", filename);
         return -1;
     }
 
-    // buffer holds each line
-    char line[MY_SIZE]; 
-    
-    // file reading logic
-    while (fgets(line, sizeof(line), file) != NULL) {
-        // tokenize
-        // printf("Line: %s\n", line); // debug
-        tokenize(line);
+    struct stat info;
+    bool regular = fstat(fd, &info) == 0 && S_ISREG(info.st_mode); // only a regular file's size means anything
+    if (regular && (uintmax_t)info.st_size >= UINT32_MAX) {
+        fprintf(stderr, "@ Error: File %s is too large, token offsets are limited to 4GB\n", filename);
+        close(fd);
+        return -1;
+    }
+    if (regular && info.st_size > 0) {
+        void *mapping = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            posix_madvise(mapping, info.st_size, POSIX_MADV_SEQUENTIAL); // we only ever walk forwards
+            Source = mapping;
+            SourceLength = info.st_size;
+            SourceMapped = true;
+        }
     }
 
-    // error checking: file is empty
-    if (ferror(file)) {
-        printf("@ Error: Could not read file %s\n", filename);
-        fclose(file);
-        return -1;
+    // not a regular file, empty, or mmap refused, fall back to reading it all in
+    if (!SourceMapped) {
+        char *buffer = slurpFile(fd, &SourceLength);
+        // error checking: file could not be read
+        if (!buffer) {
+            fprintf(stderr, "@ Error: Could not read file %s\n", filename);
+            close(fd);
+            return -1;
+        }
+        Source = buffer;
     }
     
-    // closes file
-    fclose(file);
+    // closes file, the mapping stays valid until releaseSource()
+    close(fd);
+    return 0;
+}
+
+// unmap (or free) the source buffer once nothing needs the token views anymore
+void releaseSource() {
+    if (SourceMapped) {
+        munmap((void*)Source, SourceLength);
+    } else {
+        free((void*)Source);
+    }
+    Source = NULL;
+    SourceLength = 0;
+    SourceMapped = false;
+}
 
-    // At the end of input, add an end token
-    addToken(TknEnd, "END"); // Add end token when reaching the end of the code
+// ------------------------------------------- PARALLEL LEXING -------------------------------------- //
 
-    return 0;
+// with --jobs N a big source is cut into chunks at newlines and the chunks are lexed at the same time on N threads.
+// no token spans a newline and indentation starts again on every line, so a chunk lexes exactly the same on its own
+// as it would as part of the whole file. the token stream then reads the chunks back in order
+#define LEX_CHUNK_MIN (256 * 1024) // smallest chunk worth handing to a thread
+#define LEX_CHUNKS_PER_JOB 4 // a few chunks per thread so one slow chunk doesn't hold everyone up
+
+typedef struct {
+    const char *start; // first character of the chunk, always the start of a line
+    size_t length; // the chunk ends just after a newline, or at the end of Source
+    Token *tokens; // tokens lexed from the chunk, freed once the token stream has read past them
+    int count;
+    int capacity;
+} LexChunk;
+
+int LexJobs = 1; // --jobs, 1 means lex on demand on the main thread
+LexChunk *LexChunks = NULL; // NULL unless the source was lexed in parallel
+int LexChunkCount = 0;
+atomic_int NextLexChunk; // next chunk for a worker to pick up
+
+// thread body, keeps taking chunks until there are none left
+void* lexWorker(void *unused) {
+    (void)unused;
+    int index;
+    while ((index = atomic_fetch_add(&NextLexChunk, 1)) < LexChunkCount) {
+        LexChunk *chunk = &LexChunks[index];
+        Lexer lexer;
+        initLexer(&lexer, chunk->start, chunk->length);
+        lexer.worker = true;
+        Token token;
+        while (lexToken(&lexer, &token)) {
+            chunk->tokens = growArray(chunk->tokens, &chunk->capacity, chunk->count + 1, sizeof(Token));
+            chunk->tokens[chunk->count++] = token;
+        }
+    }
+    return NULL;
 }
 
-// ###################################### TOKENISATION END ######################################
+// cut Source into chunks at line boundaries and lex them all on jobs threads (the main thread being one of them).
+// does nothing if the source is too small to be worth splitting, the token stream then lexes it on demand as usual
+void lexInParallel(int jobs) {
+    size_t chunkCount = (size_t)jobs * LEX_CHUNKS_PER_JOB;
+    if (chunkCount > SourceLength / LEX_CHUNK_MIN) {
+        chunkCount = SourceLength / LEX_CHUNK_MIN;
+    }
+    if (jobs < 2 || chunkCount < 2) {
+        return;
+    }
+    initCharClasses(); // before any threads start, the workers only read the tables
+
+    int capacity = 0;
+    size_t target = SourceLength / chunkCount;
+    const char *pointer = Source;
+    const char *end = Source + SourceLength;
+    while (pointer < end) {
+        const char *cut = (size_t)(end - pointer) > target ? findNewline(pointer + target, end) : end;
+        if (cut < end) {
+            cut++; // the newline belongs to the chunk it ends
+        }
+        LexChunks = growArray(LexChunks, &capacity, LexChunkCount + 1, sizeof(LexChunk));
+        LexChunks[LexChunkCount++] = (LexChunk){ .start = pointer, .length = cut - pointer };
+        pointer = cut;
+    }
 
-// ###################################### PARSING START ######################################
+    // if a thread can't be started the rest of us just take more chunks each
+    atomic_store(&NextLexChunk, 0);
+    int threadCount = jobs - 1 < LexChunkCount - 1 ? jobs - 1 : LexChunkCount - 1;
+    pthread_t *threads = resizeArray(NULL, threadCount, sizeof(pthread_t));
+    int started = 0;
+    while (started < threadCount && pthread_create(&threads[started], NULL, lexWorker, NULL) == 0) {
+        started++;
+    }
+    lexWorker(NULL);
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
 
-// Compiler throwing hissy fit hence this
-char *strdup(const char *s) {
-    size_t len = strlen(s);
-    char *dup = malloc(len + 1);
-    if (dup) {
-        strcpy(dup, s);
+void freeLexChunks() {
+    for (int i = 0; i < LexChunkCount; i++) {
+        free(LexChunks[i].tokens);
     }
-    return dup;
+    free(LexChunks);
 }
 
+// ###################################### TOKENISATION END ######################################
+
+// ###################################### PARSING START ######################################
+
 AstNode* pFuncCall();
 AstNode* pExpression();
 AstNode* pProgram();
 
-AstNode nodes[MAX_NODES]; // not using malloc, static allocation
-int pCurrentTknIndex = 0;
 int nodeCount = 0;
 
-// Fetch the current token
-Token pCurrentTkn() {
-    return Tokens[pCurrentTknIndex];
+// lists of child nodes are built up on this stack while they're being parsed, then copied into the arena once
+// we know how long they are. nested lists just sit on top of the ones being built around them
+AstNode **Scratch = NULL;
+int ScratchCount = 0;
+int ScratchCapacity = 0;
+
+void pushScratch(AstNode *node) {
+    Scratch = growArray(Scratch, &ScratchCapacity, ScratchCount + 1, sizeof(AstNode*));
+    Scratch[ScratchCount++] = node;
 }
 
-// here is a function to grab the next token
-Token getNextTkn() {
-    return Tokens[pCurrentTknIndex++];
+// move everything pushed since base into an exactly sized arena array, returns how many there were
+int popScratch(int base, AstNode ***list) {
+    int count = ScratchCount - base;
+    *list = arenaCopy(&CompileArena, &Scratch[base], sizeof(AstNode*) * count);
+    ScratchCount = base;
+    return count;
 }
 
-// Increment token index
-void pMoveToNextTkn() {
-    if (pCurrentTknIndex < TknCount - 1) {
-        pCurrentTknIndex++;
+// the parser pulls tokens from the lexer as it needs them rather than the whole file being tokenized up front,
+// so token memory stays the same size however big the program is. the parser only ever looks one token either
+// side of the current one, those live in a little ring buffer indexed by a running token count
+#define TKN_RING_SIZE 4 // must be a power of two, and more than previous + current + next
+Token TknRing[TKN_RING_SIZE];
+uint32_t TknPosition = 0; // running number of the current token
+uint32_t TknLexed = 0; // tokens pulled from the lexer so far, the newest is TknLexed - 1
+Lexer SourceLexer; // lexer over the whole of Source
+int ReadChunk = 0; // with --jobs, the chunk the stream is reading tokens from
+int ReadChunkToken = 0; // and the next token in it
+
+// start the token stream at the beginning of Source
+void initTokenStream() {
+    initLexer(&SourceLexer, Source, SourceLength);
+    TknPosition = 0;
+    TknLexed = 0;
+    ReadChunk = 0;
+    ReadChunkToken = 0;
+}
+
+// get the next token of the source, returns false once there are none left
+// after parallel lexing they come out of the chunks in order, otherwise straight from the lexer
+bool pullToken(Token *token) {
+    if (!LexChunks) {
+        return lexToken(&SourceLexer, token);
     }
+    while (ReadChunk < LexChunkCount) {
+        LexChunk *chunk = &LexChunks[ReadChunk];
+        if (ReadChunkToken == chunk->count) { // finished with this chunk
+            free(chunk->tokens);
+            chunk->tokens = NULL;
+            ReadChunk++;
+            ReadChunkToken = 0;
+            continue;
+        }
+        *token = chunk->tokens[ReadChunkToken++];
+        if (token->type == TknIdentifier) {
+            internIdentifier(token); // interned here, in order, so ids come out the same as lexing on demand
+            return true;
+        }
+        if (token->type == TknError) {
+            // lex the bad lexeme again on this thread so the error is reported (and --check recovers) just as it
+            // would have been without --jobs. the worker already skipped the rest of the line
+            Lexer relex = { .pointer = tknText(token), .end = Source + SourceLength };
+            Token ignored;
+            lexToken(&relex, &ignored);
+            continue;
+        }
+        return true;
+    }
+    return false;
 }
 
-// add new node from token to tree
-AstNode* createNode(NodeType type){
-    if (nodeCount < MAX_NODES) {
-        AstNode *node = &nodes[nodeCount++];
-        node -> type = type;
-        return node;
-    } else {
-        fprintf(stderr, "@ Error: Maximum no. of nodes reached. Memory allocation exhausted.");
-        exit(EXIT_FAILURE);
+// get the token ahead places after the current one, lexing it if it hasn't been yet
+// once the source runs out every further token is an end token
+const Token* tknAhead(uint32_t ahead) {
+    while (TknLexed <= TknPosition + ahead) {
+        Token *slot = &TknRing[TknLexed & (TKN_RING_SIZE - 1)];
+        if (!pullToken(slot)) {
+            setToken(slot, TknEnd, Source + SourceLength, 0); // Add end token when reaching the end of the code
+        }
+        TknLexed++;
     }
+    return &TknRing[(TknPosition + ahead) & (TKN_RING_SIZE - 1)];
 }
 
-// Array to store function names
-char ExistingFunctions[50][256]; // based on max 50 unique identifiers
-int FunctionsCount = 0;  // Counter for the number of functions
+// Fetch the current token
+const Token* pCurrentTkn() {
+    return tknAhead(0);
+}
 
-// Function to add function names to the array
-void addFunctionName(const char* identifier) {
-    if (FunctionsCount < 50) { //
-        strcpy(ExistingFunctions[FunctionsCount++], identifier);
-    }
+// the token before the current one, still in the ring
+const Token* pPrevTkn() {
+    return &TknRing[(TknPosition - 1) & (TKN_RING_SIZE - 1)];
 }
 
-//Function to check if function identifer within the array
-bool doesFunctionExist(const char* funcID) {
-    for (int i = 0; i < FunctionsCount; i++) {
-        if (strcmp(ExistingFunctions[i], funcID) == 0) {
-            return true; // name already exists
-        }
+// Move on to the next token, we never move past the end token
+void pMoveToNextTkn() {
+    if (pCurrentTkn()->type != TknEnd) {
+        TknPosition++;
     }
-return false;
 }
 
-bool hasOperatorInExpression(AstNode* node) {
-    if (!node) return false;
-
-    switch (node->type) {
-        case nodeExpression:
-        case nodeTerm:
-            // If the expression or term has an operator, return true
-            if (node->data.Expression.oper != NULL || node->data.term.oper != NULL) {
-                return true;
-            }
+// look at the token after the current one without moving, the end token is its own next token
+const Token* pPeekTkn() {
+    return pCurrentTkn()->type == TknEnd ? pCurrentTkn() : tknAhead(1);
+}
 
-            // Recursively check the left and right variables of the expression/term
-            if (hasOperatorInExpression(node->data.Expression.lVar) || 
-                hasOperatorInExpression(node->data.Expression.rVar)) {
-                return true;
-            }
-            break;
+// add new node from token to tree, nodes come out of the arena already zeroed
+AstNode* createNode(NodeType type){
+    AstNode *node = arenaAlloc(&CompileArena, sizeof(AstNode));
+    node -> type = type;
+    nodeCount++;
+    return node;
+}
 
-        case nodeFactor:
-            // If it's a function call or nested expression, check that recursively
-            if (node->data.factor.funcCall) {
-                return hasOperatorInExpression(node->data.factor.funcCall);
-            } else if (node->data.factor.exp) {
-                return hasOperatorInExpression(node->data.factor.exp);
-            }
-            break;
+// everything we know about a defined function, filled in by pFuncDef() and looked up through the
+// function's symbol so resolving a call is a single index rather than a search
+#define FUNC_PRINTS 0x01 // body prints something itself
+#define FUNC_CALLS_IMPURE 0x02 // body calls a function that isn't pure
+#define FUNC_RECURSIVE 0x04 // body calls the function itself
+#define FUNC_USES_OWN_RESULT 0x08 // body uses what a call to the function itself returns
 
-        default:
-            break;
+typedef struct {
+    int32_t symbol; // the function's name
+    int arity; // number of parameters
+    uint32_t flatDefinition; // its nodeFunctionDef in the flat AST, once it's been flattened
+    bool returnsValue; // body has a return statement, otherwise the function is void
+    uint32_t ownResultOffset; // where FUNC_USES_OWN_RESULT was first set, reported if the body never returns
+    uint8_t returnType; // ValueType of what it returns, worked out by inferTypes()
+    uint8_t flags; // FUNC_ bits
+} FunctionInfo;
+
+FunctionInfo *Functions = NULL; // Functions[0] is unused so a symbol's function index can be 0 for "none"
+int FunctionCount = 0;
+int FunctionCapacity = 0;
+int32_t CurrentFunction = 0; // index of the function whose body is being parsed, 0 at the top level
+
+// Function to record a new function name, returns its index in Functions
+int32_t addFunctionName(const Token *token) {
+    if (FunctionCount == 0) {
+        FunctionCount = 1; // skip the "none" entry
     }
+    Functions = growArray(Functions, &FunctionCapacity, FunctionCount + 1, sizeof(FunctionInfo));
+    int32_t index = FunctionCount++;
+    Functions[index] = (FunctionInfo){ .symbol = token->id };
+    Symbols[token->id].function = index;
+    return index;
+}
 
-    return false;
+//Function to check if function identifer has been defined
+bool doesFunctionExist(const Token *funcID) {
+    return funcID->type == TknIdentifier && Symbols[funcID->id].function != 0;
+}
+
+// look up the function a symbol names, NULL if it isn't one
+FunctionInfo* lookupFunction(int32_t symbol) {
+    return Symbols[symbol].function ? &Functions[Symbols[symbol].function] : NULL;
+}
+
+// a function is pure if it prints nothing and only calls pure functions (calling itself doesn't count against it)
+bool isPureFunction(const FunctionInfo *function) {
+    return !(function->flags & (FUNC_PRINTS | FUNC_CALLS_IMPURE));
+}
+
+// check a call against what we know about the function and note what it means for the caller's purity
+void resolveCall(int32_t symbol, int argCount, bool usesResult) {
+    FunctionInfo *callee = lookupFunction(symbol);
+    if (argCount != callee->arity) {
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Function '%s' takes %d argument(s) but was called with %d.\n", symName(symbol), callee->arity, argCount);
+    }
+    bool isSelf = CurrentFunction != 0 && callee == &Functions[CurrentFunction];
+    if (usesResult && !isSelf && !callee->returnsValue) { // a recursive call's return statement may still be coming
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Function '%s' does not return a value and can't be used in an expression.\n", symName(symbol));
+    }
+    if (CurrentFunction != 0) {
+        if (isSelf) {
+            if (usesResult && !(callee->flags & FUNC_USES_OWN_RESULT)) {
+                callee->flags |= FUNC_USES_OWN_RESULT;
+                callee->ownResultOffset = pCurrentTkn()->offset;
+            }
+            Functions[CurrentFunction].flags |= FUNC_RECURSIVE;
+        } else if (!isPureFunction(callee)) {
+            Functions[CurrentFunction].flags |= FUNC_CALLS_IMPURE;
+        }
+    }
 }
 
+// operators are stored as pointers to these literals rather than copies of the token
+const char* operatorName(const Token *token) {
+    switch (*tknText(token)) {
+        case '+': return "+";
+        case '-': return "-";
+        case '*': return "*";
+        default: return "/";
+    }
+}
 
 AstNode* pFactor() {
     AstNode* factorNode = NULL;
     
     // check for number existence
-    if (pCurrentTkn().type == TknNumber) {
+    if (pCurrentTkn()->type == TknNumber) {
         factorNode = createNode(nodeFactor);
-        factorNode -> data.factor.constant = atof(pCurrentTkn().value);
+        factorNode -> data.factor.constant = tknToDouble(pCurrentTkn());
+        factorNode -> data.factor.literal = pCurrentTkn()->offset;
         pMoveToNextTkn();
     }
     // check for float existence
-    else if (pCurrentTkn().type == TknFloat) {
+    else if (pCurrentTkn()->type == TknFloat) {
         factorNode = createNode(nodeFactor);
-        factorNode -> data.factor.constant = atof(pCurrentTkn().value);
+        factorNode -> data.factor.constant = tknToDouble(pCurrentTkn());
+        factorNode -> data.factor.literal = pCurrentTkn()->offset;
         pMoveToNextTkn();
     } 
-    else if (pCurrentTkn().type == TknIdentifier) {
+    else if (pCurrentTkn()->type == TknIdentifier) {
         // if function call
-        if (doesFunctionExist(pCurrentTkn().value)) { 
+        if (doesFunctionExist(pCurrentTkn())) { 
             factorNode = createNode(nodeFactor);
             factorNode -> data.factor.funcCall = pFuncCall();
         }
         //not function call
         else    {
             factorNode = createNode(nodeFactor);
-            factorNode -> data.factor.identifier = strdup(pCurrentTkn().value);
+            factorNode -> data.factor.identifier = pCurrentTkn()->id;
             pMoveToNextTkn();
-            //if (pCurrentTkn().type != TknNewline && pCurrentTkn().type != TknEnd) {
+            //if (pCurrentTkn()->type != TknNewline && pCurrentTkn()->type != TknEnd) {
             //    printf ("! SYNTAX ERROR: Expected new line after non-function name identifier\n.");
             //    exit(1);
             //}
         }
-    } else if (pCurrentTkn().type == TknLBracket) {
+    } else if (pCurrentTkn()->type == TknLBracket) {
         pMoveToNextTkn();
         factorNode = createNode(nodeFactor);
         // check stuff within the brackets 
         factorNode -> data.factor.exp = pExpression();
-            if(pCurrentTkn().type != TknRBracket) {
-                printf("! SYNTAX ERROR: Invalid factor. Expected ')' after expression.\n");
-                exit(1);
+            if(pCurrentTkn()->type != TknRBracket) {
+                syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Invalid factor. Expected ')' after expression.\n");
             }    
         pMoveToNextTkn(); // consume ')
         return factorNode;
         
     } 
     else {
-        printf(" TOKEN : '%s' (Type: %d)\n", pCurrentTkn().value, pCurrentTkn().type);
-        printf("! SYNTAX ERROR: Invalid factor. Expected functioncall, real constant, identifer or '(' expression ')'.\n.");
-        exit(1);
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Invalid factor %s. Expected functioncall, real constant, identifer or '(' expression ')'.\n", tknDescription(pCurrentTkn()));
     }
     return factorNode;
 }
 
-// creating that left right operator child tree
-AstNode* pTerm(){
-    AstNode* fctrNode = pFactor(); // parse first factor
-    // if is factor operator must parse recursively
-
-    // debug
-    if (!fctrNode) {
-        printf("! SYNTAX ERROR: Expected a valid factor.\n");
-        return NULL; // Handle error
-    }
-    while (pCurrentTkn().type == TknFactorOperator) {
-        char* oper = strdup(pCurrentTkn().value); // store oper
-
-
-        pMoveToNextTkn(); // move to next token
-        AstNode* rVarNode = pTerm(); // parse next token
+// operators waiting to be applied while an expression is parsed, shared by nested expressions (brackets,
+// call arguments) the same way Scratch is: each pExpression() only touches what it pushed itself
+const char **OperStack = NULL;
+int OperCount = 0;
+int OperCapacity = 0;
 
-        // debug
-        if (!rVarNode) {
-            printf("! SYNTAX ERROR: Expected valid factor after operator '%s'.\n", oper);
-            free(oper); // Clean up
-            return NULL; // Handle error
-        }
+// how tightly an operator binds, * and / before + and -
+int operPrecedence(const char *oper) {
+    return (oper[0] == '*' || oper[0] == '/') ? 2 : 1;
+}
 
-        AstNode* termNode = createNode(nodeTerm);
-        termNode -> data.term.lVar = fctrNode; // node given lVar property i.e. the left factor 
-        termNode -> data.term.rVar = rVarNode; // right variable 
-        termNode -> data.term.oper = oper; // operator assigned as well
-        fctrNode = termNode; 
-    } 
-    return fctrNode;
+// pop the top operator and its two operands off the stacks and push the node combining them
+void reduceExpression() {
+    const char *oper = OperStack[--OperCount];
+    AstNode *rVarNode = Scratch[--ScratchCount];
+    AstNode *lVarNode = Scratch[--ScratchCount];
+
+    // + and - make expression nodes, * and / make term nodes
+    AstNode *node = createNode(operPrecedence(oper) == 2 ? nodeTerm : nodeExpression);
+    node -> data.Expression.lVar = lVarNode; // node given lVar property i.e. the left operand
+    node -> data.Expression.rVar = rVarNode; // right operand
+    node -> data.Expression.oper = oper; // operator assigned as well
+    pushScratch(node);
 }
 
+// parse factors separated by + - * / with precedence climbing, operands wait on the scratch stack and operators
+// on OperStack. nothing recurses per operator, so long expressions can't blow the C stack, and equal precedence
+// operators reduce left to right so a - b - c comes out as (a - b) - c
 AstNode* pExpression(){
-    AstNode* termNode = pTerm(); // parse first term
-    if (!termNode) {
-        printf("! SYNTAX ERROR: Expected a valid term.\n");
-        return NULL; // Return or handle error
-    }
-    
-    while (pCurrentTkn().type == TknTermOperator) {
-        char* oper = strdup(pCurrentTkn().value);
-        pMoveToNextTkn();
-        AstNode* rVarNode = pExpression();
+    int operBase = OperCount;
+    int operandBase = ScratchCount;
 
-        // debug
-        if (!rVarNode) {
-            printf("! SYNTAX ERROR: Expected valid expression after operator '%s'.\n", oper);
-            free(oper); // Clean up
-            return NULL; // Handle error
-        }
+    pushScratch(pFactor()); // parse first factor
 
-        AstNode* exprNode = createNode(nodeExpression);
-        exprNode -> data.Expression.lVar = termNode; 
-        exprNode -> data.Expression.oper = oper;
-        exprNode->data.Expression.rVar = rVarNode;
-        termNode = exprNode;
-    
-    } 
-    return termNode;
-}
+    while (pCurrentTkn()->type == TknTermOperator || pCurrentTkn()->type == TknFactorOperator) {
+        const char* oper = operatorName(pCurrentTkn()); // store oper
 
-#define MAX_ARGS 1000
-AstNode* pFuncCall() {
-    AstNode* funcCallNode = createNode(nodeFunctionCall);
+        // anything already waiting that binds at least as tightly gets built first
+        while (OperCount > operBase && operPrecedence(OperStack[OperCount - 1]) >= operPrecedence(oper)) {
+            reduceExpression();
+        }
+        OperStack = growArray(OperStack, &OperCapacity, OperCount + 1, sizeof(const char*));
+        OperStack[OperCount++] = oper;
 
-    // Consume (EDIT: STORE) the function name
-    if (pCurrentTkn().type == TknLBracket) {
-    funcCallNode -> data.funcCall.identifier = strdup(Tokens[pCurrentTknIndex -1].value);
-    printf("FumcCall: %s\n", funcCallNode->data.funcCall.identifier);
+        pMoveToNextTkn(); // move to next token
+        pushScratch(pFactor()); // parse next factor
     }
-    else {
-    funcCallNode -> data.funcCall.identifier = strdup(Tokens[pCurrentTknIndex].value);
-    printf("FumcCall: %s\n", funcCallNode->data.funcCall.identifier);
+
+    while (OperCount > operBase) {
+        reduceExpression();
     }
-    pMoveToNextTkn(); // function identifier eaten    
-    // throwing errors so lets do some malloc bullcrap
-    funcCallNode -> data.funcCall.args = malloc(sizeof(AstNode*) * MAX_ARGS);
-    funcCallNode -> data.funcCall.argCount = 0;
+    AstNode *expNode = Scratch[operandBase];
+    ScratchCount = operandBase;
+    return expNode;
+}
 
+#define MAX_ARGS 1000
+
+// parse the "( expression, expression ... )" after a function name, shared by calls in expressions and call statements
+// the arguments are gathered on the scratch stack and then copied into the arena at exactly the size needed
+int pArgs(AstNode ***args) {
     // Check for the left bracket
-    if (pCurrentTkn().type == TknLBracket) {
+    if (pCurrentTkn()->type == TknLBracket) {
         pMoveToNextTkn();  // Consume '('
     }
     else {
-        printf("! SYNTAX ERROR: Expected '(' after functioncall.\n");
-        exit(1);
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Expected '(' after functioncall.\n");
     }
-    
+
+    int base = ScratchCount;
     while (1) {
-    if (pCurrentTkn().type == TknRBracket) {
+    if (pCurrentTkn()->type == TknRBracket) {
         break;  // End of arguments
-    } else if (pCurrentTkn().type == TknEnd || pCurrentTkn().type == TknNewline) {
-        printf("! SYNTAX ERROR: Unexpected end or newline in function call arguments.\n");
+    } else if (pCurrentTkn()->type == TknEnd || pCurrentTkn()->type == TknNewline) {
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Unexpected end or newline in function call arguments.\n");
         break;  // Exit early if we hit an end or newline
     }
     // Parse 
     AstNode* paramNode = pExpression();
     if (paramNode) {
-        funcCallNode->data.funcCall.args[funcCallNode->data.funcCall.argCount++] = paramNode;
+        pushScratch(paramNode);
     } else {
-        printf("! SYNTAX ERROR: Invalid factor. Expected valid expression.\n");
-        exit(1);
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Invalid factor. Expected valid expression.\n");
     }
 
     // Check for additional parameters
-    if (pCurrentTkn().type == TknComma) {
+    if (pCurrentTkn()->type == TknComma) {
         pMoveToNextTkn();  // Consume ','
-    } else if (pCurrentTkn().type != TknRBracket) {
-        printf("! SYNTAX ERROR: Expected ',' or ')' in function call arguments.\n");
-        exit(1);
+    } else if (pCurrentTkn()->type != TknRBracket) {
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Expected ',' or ')' in function call arguments.\n");
     }
 }
     // Check for the right parenthesis ')'
-    if (pCurrentTkn().type == TknRBracket) {
-         pMoveToNextTkn();  // Consume ')'} 
-        return funcCallNode;
-        
+    if (pCurrentTkn()->type == TknRBracket) {
+         pMoveToNextTkn();  // Consume ')'
     } else {
-        printf("! SYNTAX ERROR: Expected ')' after function parameters.\n");
-        exit(1);
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Expected ')' after function parameters.\n");
     }
+    return popScratch(base, args);
 }
 
-#define MAX_VARIABLES 50
-
-char variableNames[MAX_VARIABLES][12];
-int variableCount = 0;
+AstNode* pFuncCall() {
+    AstNode* funcCallNode = createNode(nodeFunctionCall);
 
-// Function to add a variable name
-void addVariable(const char* name) {
-    if (variableCount < MAX_VARIABLES) {
-        strncpy(variableNames[variableCount++], name, 12);
+    // Consume (EDIT: STORE) the function name
+    if (pCurrentTkn()->type == TknLBracket) {
+    funcCallNode -> data.funcCall.identifier = pPrevTkn()->id;
+    }
+    else {
+    funcCallNode -> data.funcCall.identifier = pCurrentTkn()->id;
     }
+    funcCallNode -> data.funcCall.isStatement = false;
+    pMoveToNextTkn(); // function identifier eaten    
+    funcCallNode -> data.funcCall.argCount = pArgs(&funcCallNode -> data.funcCall.args);
+    resolveCall(funcCallNode -> data.funcCall.identifier, funcCallNode -> data.funcCall.argCount, true);
+    return funcCallNode;
 }
 
 // parsing over statements
 AstNode* pStmt() {
     AstNode* stmtNode = createNode(nodeStmt);
     
-    switch (pCurrentTkn().type) {
+    switch (pCurrentTkn()->type) {
         case TknIdentifier:            
-            if (doesFunctionExist(pCurrentTkn().value)) {
-                // stmtNode -> data.stmt.data.funcCall;
-                stmtNode->data.stmt.data.funcCall.identifier = strdup(pCurrentTkn().value);
+            if (doesFunctionExist(pCurrentTkn())) {
+                stmtNode->data.funcCall.identifier = pCurrentTkn()->id;
+                stmtNode->data.funcCall.isStatement = true;
                 pMoveToNextTkn(); // consume identifier
 
-//identical to function call but need repeat for reasons
-                
-                // throwing errors so lets do some malloc 
-                stmtNode -> data.stmt.data.funcCall.args = malloc(sizeof(AstNode*) * MAX_ARGS);
-                stmtNode -> data.stmt.data.funcCall.argCount = 0;
-
-                // Check for the left bracket
-                if (pCurrentTkn().type == TknLBracket) {
-                    pMoveToNextTkn();  // Consume '('
-                }
-                else {
-                    printf("! SYNTAX ERROR: Expected '(' after functioncall.\n");
-                    exit(1);
-                }
-
-                while (1) {
-                    if (pCurrentTkn().type == TknRBracket) {
-                     break;  // End of arguments
-                } else if (pCurrentTkn().type == TknEnd || pCurrentTkn().type == TknNewline) {
-                    printf("! WARNING: Unexpected end or newline in function call arguments.\n");
-                    break;  // Exit early if we hit an end or newline
-                }
-
-                // Parse the expression
-                AstNode* paramNode = pExpression();
-                if (paramNode) {
-                    stmtNode->data.stmt.data.funcCall.args[stmtNode->data.stmt.data.funcCall.argCount++] = paramNode;
-                } else {
-                    printf("! SYNTAX ERROR: Invalid factor. Expected valid expression.\n");
-                    exit(1);
-                }
-
-                // Check for additional parameters
-                if (pCurrentTkn().type == TknComma) {
-                    pMoveToNextTkn();  // Consume ','
-                } else if (pCurrentTkn().type != TknRBracket) {
-                    printf("! SYNTAX ERROR: Expected ',' or ')' in function call arguments.\n");
-                    exit(1);
-                }
-                }
-                // Check for the right parenthesis ')'
-                if (pCurrentTkn().type == TknRBracket) {
-                    pMoveToNextTkn();  // Consume ')'}         
-                } else {
-                    printf("! SYNTAX ERROR: Expected ')' after function parameters.\n");
-                    exit(1);
-                }
-    /// identical code to function caller but need it for reasons 
-
+                stmtNode -> data.funcCall.argCount = pArgs(&stmtNode -> data.funcCall.args);
+                resolveCall(stmtNode -> data.funcCall.identifier, stmtNode -> data.funcCall.argCount, false);
                 stmtNode->type = nodeFunctionCall;
                 break;
             } else {
                 // assignment
-                addVariable(pCurrentTkn().value);
-                stmtNode -> data.stmt.data.assignment.identifier = strdup(pCurrentTkn().value); // store identifier
+                stmtNode -> data.stmt.data.assignment.identifier = pCurrentTkn()->id; // store identifier
                 pMoveToNextTkn(); // move to next token
                 
                 //check assignment operator correctly exists here
-                if (pCurrentTkn().type == TknAssignmentOperator) {
+                if (pCurrentTkn()->type == TknAssignmentOperator) {
                     pMoveToNextTkn(); // consume the assignment operator
                     
                     stmtNode -> data.stmt.data.assignment.exp = pExpression();
@@ -767,25 +1457,25 @@ AstNode* pStmt() {
                 
                     // validate expression exists for assignment operator 
                     if (!stmtNode->data.stmt.data.assignment.exp) {
-                        printf("! SYNTAX ERROR: Expected a valid expression term after assignment operator '<-'.\n");
-                        exit(EXIT_FAILURE);
+                        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Expected a valid expression term after assignment operator '<-'.\n");
                     }
                 } else {
-                    printf("! SYNTAX ERROR: Expected assignment operator '<-' after non-function name identifier.\n") ;
-                    exit(EXIT_FAILURE);
+                    syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Expected assignment operator '<-' after non-function name identifier.\n");
                 }     
                 break;
             }
 
         case TknPrint:
+            if (CurrentFunction != 0) { // printing makes the function impure
+                Functions[CurrentFunction].flags |= FUNC_PRINTS;
+            }
             pMoveToNextTkn(); // eat print nom nom nom 
             stmtNode -> data.stmt.data.print.exp = pExpression();
             stmtNode -> type = nodePrint;
 
             // validate that expression exists
             if (!stmtNode->data.stmt.data.print.exp) {
-                printf("! SYNTAX ERROR: Expected a valid expression after 'print'.\n");
-                exit(EXIT_FAILURE);
+                syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Expected a valid expression after 'print'.\n");
             }
             break;
 
@@ -796,94 +1486,120 @@ AstNode* pStmt() {
             
             // Validate that the expression is valid
             if (!stmtNode->data.stmt.data.returnStmt.exp) {
-                printf("! SYNTAX ERROR: Expected a valid expression after 'return'.\n");
-                exit(EXIT_FAILURE);
+                syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Expected a valid expression after 'return'.\n");
             }
             break;
         default:
             // error rip
-            printf("! SYNTAX ERROR: Unexpected token. valid statement starting args include print, return and function calls.");
-            exit(EXIT_FAILURE);
+            syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Unexpected token. valid statement starting args include print, return and function calls.\n");
     }
     return stmtNode;
 }
 
-#define MAX_PARAMS 100
-#define MAX_STATEMENTS 1000
+// start of a statement, remember where to come back to if it turns out to have a syntax error in it
+void markCheckpoint(ParseCheckpoint *checkpoint) {
+    checkpoint->scratchCount = ScratchCount;
+    checkpoint->operCount = OperCount;
+    checkpoint->function = CurrentFunction;
+    Checkpoint = checkpoint;
+}
+
+// after jumping back to a checkpoint: drop whatever the broken statement left on the parser's stacks
+// and skip the rest of its line, leaving the newline (or end) as the current token
+void recoverAtCheckpoint(ParseCheckpoint *checkpoint) {
+    ScratchCount = checkpoint->scratchCount;
+    OperCount = checkpoint->operCount;
+    CurrentFunction = checkpoint->function;
+    Checkpoint = checkpoint;
+    while (pCurrentTkn()->type != TknNewline && pCurrentTkn()->type != TknEnd) {
+        pMoveToNextTkn();
+    }
+}
+
+int32_t *ParamScratch = NULL; // parameter ids for the function currently being parsed
+int ParamScratchCapacity = 0;
+
 // parsing over a function definition
 AstNode* pFuncDef() {
-    printf("Entering pFuncDef()\n");
-
     AstNode* funcDefNode = createNode(nodeFunctionDef);
     pMoveToNextTkn();  
 
-    if (pCurrentTkn().type == TknIdentifier) {
-        if (doesFunctionExist(pCurrentTkn().value)) {
-            printf("! SYNTAX ERROR: Function name '%s' is already defined\n", pCurrentTkn().value);
-            exit(EXIT_FAILURE);
+    if (pCurrentTkn()->type == TknIdentifier) {
+        if (doesFunctionExist(pCurrentTkn())) {
+            syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Function name %s is already defined\n", tknDescription(pCurrentTkn()));
         }
 
-        addFunctionName(pCurrentTkn().value);
-        funcDefNode->data.funcDef.identifier = strdup(pCurrentTkn().value);
+        int32_t function = addFunctionName(pCurrentTkn());
+        funcDefNode->data.funcDef.identifier = pCurrentTkn()->id;
 
-        funcDefNode->data.funcDef.params = (char**)malloc(sizeof(char*) * MAX_PARAMS);
-        funcDefNode->data.funcDef.paramCount = 0;
+        int paramCount = 0;
         pMoveToNextTkn();  // move to parameters
 
-        while (pCurrentTkn().type == TknIdentifier) {
-            if (funcDefNode->data.funcDef.paramCount >= MAX_PARAMS) {
-                printf("! SYNTAX ERROR: Too many parameters in function definition\n");
-                exit(EXIT_FAILURE);
-            }
-            funcDefNode->data.funcDef.params[funcDefNode->data.funcDef.paramCount++] = strdup(pCurrentTkn().value);
+        while (pCurrentTkn()->type == TknIdentifier) {
+            ParamScratch = growArray(ParamScratch, &ParamScratchCapacity, paramCount + 1, sizeof(int32_t));
+            ParamScratch[paramCount++] = pCurrentTkn()->id;
             pMoveToNextTkn();  // move to the next param
         }
+        funcDefNode->data.funcDef.params = arenaCopy(&CompileArena, ParamScratch, sizeof(int32_t) * paramCount);
+        funcDefNode->data.funcDef.paramCount = paramCount;
+        Functions[function].arity = paramCount; // known before the body so recursive calls can be checked
 
         // newline after the function name and parameters?
-        if (pCurrentTkn().type != TknNewline) {
-            printf("! SYNTAX ERROR: Expected newline after function definition\n");
-            exit(EXIT_FAILURE);
+        if (pCurrentTkn()->type != TknNewline) {
+            syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Expected newline after function definition\n");
+        }
+
+        // Make sure that the function body contains at least one statement
+        // (checked while we're still on the header's line so --check carries on from the line after it)
+        if (pPeekTkn()->type != TknTab) {
+            syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Function body must contain at least one statement\n");
         }
         pMoveToNextTkn();  // Move past the newline
 
-        funcDefNode->data.funcDef.stmt = (AstNode**)malloc(sizeof(AstNode*) * MAX_STATEMENTS);
-        funcDefNode->data.funcDef.stmtCount = 0;
         funcDefNode->data.funcDef.isReturn = 0;  
+        int base = ScratchCount;
+        CurrentFunction = function;
 
-        while (pCurrentTkn().type == TknTab) {
-            pMoveToNextTkn();  // Move past the tab (indentation)
+        // each statement in the body gets its own checkpoint, so one bad line doesn't lose the rest of the body
+        ParseCheckpoint checkpoint;
+        ParseCheckpoint *outer = Checkpoint;
 
-            if (funcDefNode->data.funcDef.stmtCount >= MAX_STATEMENTS) {
-                printf("! SYNTAX ERROR: Too many statements in function body\n");
-                exit(EXIT_FAILURE);
-            }
+        while (pCurrentTkn()->type == TknTab) {
+            pMoveToNextTkn();  // Move past the tab (indentation)
 
-            // Parse an individual statement and add it to the function's statement list
-            AstNode* stmtNode = pStmt();  // Parse a statement specifically for the function
-            funcDefNode->data.funcDef.stmt[funcDefNode->data.funcDef.stmtCount++] = stmtNode;
-            funcDefNode->data.funcDef.stmtCount++;
+            markCheckpoint(&checkpoint);
+            if (setjmp(checkpoint.jump) == 0) {
+                // Parse an individual statement and add it to the function's statement list
+                AstNode* stmtNode = pStmt();  // Parse a statement specifically for the function
+                pushScratch(stmtNode);
 
-            // Check if the parsed statement is a return statement
-            if (stmtNode->type == nodeReturn) {
-                funcDefNode->data.funcDef.isReturn = 1;
+                // Check if the parsed statement is a return statement
+                if (stmtNode->type == nodeReturn) {
+                    funcDefNode->data.funcDef.isReturn = 1;
+                }
+            } else {
+                recoverAtCheckpoint(&checkpoint);
             }
 
             // Move to the next token after the statement
-            if (pCurrentTkn().type == TknNewline) {
+            if (pCurrentTkn()->type == TknNewline) {
                 pMoveToNextTkn();  // Move to the next line
             } else {
                 break;  // Stop if there are no more indented statements
             }
         }
 
-        // Make sure that the function body contains at least one statement
-        if (funcDefNode->data.funcDef.stmtCount == 0) {
-            printf("! SYNTAX ERROR: Function body must contain at least one statement\n");
-            exit(EXIT_FAILURE);
+        Checkpoint = outer;
+        funcDefNode->data.funcDef.stmtCount = popScratch(base, &funcDefNode->data.funcDef.stmt);
+        CurrentFunction = 0;
+        Functions[function].returnsValue = funcDefNode->data.funcDef.isReturn;
+        if (!Functions[function].returnsValue && (Functions[function].flags & FUNC_USES_OWN_RESULT)) {
+            Checkpoint = NULL; // the body itself parsed, so --check has nothing to skip over
+            syntaxError(Functions[function].ownResultOffset, "SYNTAX ERROR: Function '%s' does not return a value and can't be used in an expression.\n", symName(Functions[function].symbol));
+            Checkpoint = outer;
         }
     } else {
-        printf("! SYNTAX ERROR: Expected identifier for function name\n");
-        exit(EXIT_FAILURE);
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Expected identifier for function name\n");
     }
 
     return funcDefNode;  // Return the created function definition node
@@ -891,487 +1607,1911 @@ AstNode* pFuncDef() {
 
 AstNode* pProgItem() {
     // handle newlines (skip and continue)
-    while (pCurrentTkn().type == TknNewline) {
+    while (pCurrentTkn()->type == TknNewline) {
         pMoveToNextTkn();
     }
 
     // check for if function definition exists
-    if (pCurrentTkn().type == TknFunction) {
+    if (pCurrentTkn()->type == TknFunction) {
         return pFuncDef();
     } 
-    else if (pCurrentTkn().type == TknIdentifier 
-    || pCurrentTkn().type == TknPrint 
-    || pCurrentTkn().type == TknReturn) {
+    else if (pCurrentTkn()->type == TknIdentifier 
+    || pCurrentTkn()->type == TknPrint 
+    || pCurrentTkn()->type == TknReturn) {
         AstNode* stmtNode = pStmt();
         
         // Expect newline or end after each statement
-        if (pCurrentTkn().type == TknNewline) {
+        if (pCurrentTkn()->type == TknNewline) {
             return stmtNode;
-        } else if (pCurrentTkn().type == TknEnd) {
+        } else if (pCurrentTkn()->type == TknEnd) {
             return stmtNode;  
         } else {
-            printf("! SYNTAX ERROR: Expected newline or end after statement, got '%s'.\n", pCurrentTkn().value);
-            exit(EXIT_FAILURE);
+            syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Expected newline or end after statement, got %s.\n", tknDescription(pCurrentTkn()));
         }
         return stmtNode;
-    } else if (pCurrentTkn().type == TknEnd) {
+    } else if (pCurrentTkn()->type == TknEnd) {
         return NULL;
-    } else if (pCurrentTkn().type == TknTab) {
-            exit(EXIT_FAILURE);
+    } else if (pCurrentTkn()->type == TknTab) {
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Unexpected indentation outside of a function body.\n");
     } else {
         // handle unexpected tokens
-        printf("! SYNTAX ERROR: Unexpected token '%s'. Expected function definition or statement.\n", pCurrentTkn().value);
-        exit(EXIT_FAILURE);
+        syntaxError(pCurrentTkn()->offset, "SYNTAX ERROR: Unexpected token %s. Expected function definition or statement.\n", tknDescription(pCurrentTkn()));
     }
+    return NULL; // syntaxError() doesn't come back here
 }
 
-#define MAX_LINES 10000
 AstNode* pProgram() {
     AstNode* programNode = createNode(nodeProgram);
     
-    // line count
-    programNode -> data.program.lineCount = 0;
-    programNode->data.program.programItems = (AstNode**)malloc(sizeof(AstNode*) * MAX_LINES); // CHECK THIS PLEASE
-    if (!programNode -> data.program.programItems) {
-        fprintf(stderr, "Memory alloc error.");
-        exit(EXIT_FAILURE);
-    }
-    // parsing over program
-    while (pCurrentTkn().type != TknEnd) {
+    // parsing over program, items pile up on the scratch stack until we know how many lines there are
+    int base = ScratchCount;
+    // the checkpoint goes in before the first token is looked at, tokens are lexed on demand so a lexer error
+    // can turn up whenever the parser asks for one
+    ParseCheckpoint checkpoint;
+    while (1) {
+        markCheckpoint(&checkpoint);
+        if (setjmp(checkpoint.jump) != 0) {
+            // skip the broken line, and if it was a function header the body that went with it
+            recoverAtCheckpoint(&checkpoint);
+            while (pCurrentTkn()->type == TknNewline && pPeekTkn()->type == TknTab) {
+                pMoveToNextTkn();
+                recoverAtCheckpoint(&checkpoint);
+            }
+            continue;
+        }
+        if (pCurrentTkn()->type == TknEnd) {
+            break;
+        }
         AstNode* programItem = pProgItem();
         if (programItem != NULL) {
-            if (programNode -> data.program.lineCount < MAX_LINES) {
-                programNode -> data.program.programItems[programNode->data.program.lineCount++] = programItem;
-            } else {
-                printf("! SYNTAX ERROR: Maximum line count exceeded.");
-                exit(EXIT_FAILURE);
-            }
+            pushScratch(programItem);
         }
     }
+    Checkpoint = NULL;
+    programNode -> data.program.lineCount = popScratch(base, &programNode->data.program.programItems);
     return programNode;
 }
 
-// ------------------------------------------- INTERPRETER-------------------------------------- //
+// ------------------------------------------- FLAT AST -------------------------------------- //
 
-//declare interpreter buffer size
-#define BUFFER_SIZE 10000 // may change
+// once parsing is done the pointer tree is flattened into parallel arrays indexed by 32-bit node numbers.
+// nodes are numbered in post-order (children always before their parent, the root last) so the code
+// generator walks small contiguous arrays instead of chasing AstNode pointers around the heap
+#define NO_NODE 0 // node 0 is never used, a child slot holding 0 is empty
+#define NO_LITERAL UINT32_MAX // constant with no source text behind it
 
-char* codeBuffer; // Global buffer for C code
-int bufferLength = 0;
+#define FLAG_STMT_CALL 0x01 // nodeFunctionCall: call used as a statement rather than inside an expression
 
-// Free the buffer
-void freeBuffer() {
-    free(codeBuffer);
-}
+typedef enum {
+    TypeNone, // statements, nothing to have a type
+    TypeWhole, // always a whole number
+    TypeReal // any real number
+} ValueType; // in this order, joining two types is taking the larger
 
-// Initialize buffer
-void initBuffer() {
-    codeBuffer = malloc(BUFFER_SIZE); // CHECK THIS PLEASE
-    if (!codeBuffer) {
-        fprintf(stderr, "Memory allocation failed\n");
-        exit(1);
-    }
-    codeBuffer[0] = '\0'; // Start with an empty string
+typedef struct {
+    uint8_t *kind; // NodeType of each node
+    uint8_t *flags; // FLAG_ bits
+    uint8_t *type; // ValueType
+    char *oper; // '+', '-', '*' or '/' for expression and term nodes, 0 for everything else
+    int32_t *sym; // variable / function symbol id, 0 if the node doesn't name anything
+    uint32_t *left; // lVar, the expression of an assignment/print/return, a factor's call, or a list
+    uint32_t *right; // rVar, a factor's bracketed expression, or a function's parameter list
+    double *constant; // value of a constant factor
+    uint32_t *literal; // where a constant's lexeme starts in Source, NO_LITERAL if it was never written in the program
+    uint32_t count; // nodes used, including the unused node 0
+    int capacity;
+
+    // child lists (program items, function statements, call arguments, parameter ids) live back to back in here,
+    // each one is its length followed by its elements. a node refers to a list by the index of its length
+    uint32_t *lists;
+    int listCount;
+    int listCapacity;
+} FlatAst;
+
+FlatAst Ast; // the flattened program
+
+// number of elements in a list, and a pointer to the first one
+uint32_t listLength(uint32_t list) {
+    return Ast.lists[list];
 }
 
-void addToCodeBuffer(const char* str) {
-    int len = strlen(str);
-    if (bufferLength + len >= BUFFER_SIZE) {
-        // Resize buffer if necessary
-        char* newBuffer = realloc(codeBuffer, bufferLength + len + 1);
-        if (!newBuffer) {
-            fprintf(stderr, "Memory reallocation failed\n");
-            freeBuffer(); // Clean up existing buffer
-            exit(1);
-        }
-        codeBuffer = newBuffer;
-    }
-    strcat(codeBuffer, str);
-    bufferLength += len;
+const uint32_t* listItems(uint32_t list) {
+    return &Ast.lists[list + 1];
 }
 
-const char* getExpStr(AstNode* expr) {
-    static char buffer[100]; 
-    buffer[0] = '\0'; 
-
-    if (!expr) return buffer;
-
-    switch (expr->type) {
-        case nodeFactor:
-            snprintf(buffer, sizeof(buffer), "%s", expr->data.factor.identifier); 
-            break;
-        case nodeExpression:
-            snprintf(buffer, sizeof(buffer), "%s %s %s",
-                getExpStr(expr->data.Expression.lVar),
-                expr->data.Expression.oper,
-                getExpStr(expr->data.Expression.rVar));
-            break;
-        default:
-            break;
+// grab a fresh node, all of its fields start out empty
+uint32_t flatNewNode(NodeType kind) {
+    if ((int)Ast.count == Ast.capacity) { // every array grows together
+        int newCapacity = Ast.capacity ? Ast.capacity * 2 : 1024;
+        Ast.kind = resizeArray(Ast.kind, newCapacity, sizeof(uint8_t));
+        Ast.flags = resizeArray(Ast.flags, newCapacity, sizeof(uint8_t));
+        Ast.type = resizeArray(Ast.type, newCapacity, sizeof(uint8_t));
+        Ast.oper = resizeArray(Ast.oper, newCapacity, sizeof(char));
+        Ast.sym = resizeArray(Ast.sym, newCapacity, sizeof(int32_t));
+        Ast.left = resizeArray(Ast.left, newCapacity, sizeof(uint32_t));
+        Ast.right = resizeArray(Ast.right, newCapacity, sizeof(uint32_t));
+        Ast.constant = resizeArray(Ast.constant, newCapacity, sizeof(double));
+        Ast.literal = resizeArray(Ast.literal, newCapacity, sizeof(uint32_t));
+        Ast.capacity = newCapacity;
     }
-    return buffer;
+    uint32_t node = Ast.count++;
+    Ast.kind[node] = kind;
+    Ast.flags[node] = 0;
+    Ast.type[node] = TypeNone;
+    Ast.oper[node] = 0;
+    Ast.sym[node] = 0;
+    Ast.left[node] = NO_NODE;
+    Ast.right[node] = NO_NODE;
+    Ast.constant[node] = 0;
+    Ast.literal[node] = NO_LITERAL;
+    return node;
 }
 
-
-void writeCFile() {
-    FILE *cFile = fopen("mlProgram.c", "w");
-    if (cFile == NULL) {
-        fprintf(stderr, "! Error: Could not create C file\n");
-        return;
-    }
-    fprintf(cFile, "%s", codeBuffer); // buffer to file
-    fclose(cFile);
+// reserve room for a list of length elements and return its index, the caller fills in the elements
+uint32_t flatNewList(uint32_t length) {
+    Ast.lists = growArray(Ast.lists, &Ast.listCapacity, Ast.listCount + length + 1, sizeof(uint32_t));
+    uint32_t list = Ast.listCount;
+    Ast.lists[list] = length;
+    Ast.listCount += length + 1;
+    return list;
 }
 
-bool containsFunctionCall(AstNode* node) {
-    if (!node) return false;
+uint32_t flattenNode(AstNode *node);
 
-    if (node->type == nodeFunctionCall) {
-        return true;
-    }
-
-    // Check if it's an expression or term and recursively check its components
-    switch (node->type) {
-        case nodeExpression:
-            return containsFunctionCall(node->data.Expression.lVar) || 
-                   containsFunctionCall(node->data.Expression.rVar);
-        case nodeTerm:
-            return containsFunctionCall(node->data.term.lVar) || 
-                   containsFunctionCall(node->data.term.rVar);
-        case nodeFactor:
-            if (node->data.factor.funcCall) {
-                return true; // This node contains a function call
-            }
-            return containsFunctionCall(node->data.factor.exp);
-        default:
-            return false; // No function call found in this node
+// flatten a list of child nodes, the children are numbered before the list is built
+uint32_t flattenList(AstNode **items, int count) {
+    uint32_t *children = resizeArray(NULL, count ? count : 1, sizeof(uint32_t));
+    for (int i = 0; i < count; i++) {
+        children[i] = flattenNode(items[i]);
     }
+    uint32_t list = flatNewList(count);
+    memcpy(&Ast.lists[list + 1], children, sizeof(uint32_t) * count);
+    free(children);
+    return list;
 }
 
-// defining translation to rudimentaty C program
-void toC(AstNode* node) {
-
-    // first we gotta check if the node is existing
+// copy one pointer node (and everything under it) into Ast, returns its node number
+uint32_t flattenNode(AstNode *node) {
     if (!node) {
-        return;
+        return NO_NODE;
     }
+    uint32_t flat;
     switch (node->type) {
-        case nodeProgram:
-            addToCodeBuffer("#include <stdio.h>\n\n");
-
-            // Generate variable declarations
-            for (int i = 0; i < variableCount; i++) {
-                addToCodeBuffer("AssiType ");
-                addToCodeBuffer(variableNames[i]);
-                addToCodeBuffer(";\n");
-            }
-
-            // Flag to check if funcdef exists
-            bool functionDefined = false;
-            // int storedI = 0;
-            // First pass to collect function definitions
-            for (int i = 0; i < node->data.program.lineCount; i++) {
-                if (node->data.program.programItems[i]->type == nodeAssignment && !functionDefined) { // handle global variable
-                    addToCodeBuffer("AssiType "); // to do
-                    addToCodeBuffer(node->data.program.programItems[i]->data.stmt.data.assignment.identifier);
-                    addToCodeBuffer(" = ");
-                    toC(node->data.program.programItems[i]->data.stmt.data.assignment.exp);
-                    addToCodeBuffer(";\n");
-                }
-                else if (node->data.program.programItems[i]->type == nodeFunctionDef) {
-                    functionDefined = true;
-                    toC(node->data.program.programItems[i]);
-                }
-            }
-
-            // add main functions
-            addToCodeBuffer("int main(int argc, char *argv[]) {\n");
-            bool hasReturn = false; // flag to track if a return statement is made in main
-
-for (int j = 0; j < node->data.program.lineCount; j++) {
-    if (node->data.program.programItems[j]->type == nodePrint) { // Handle print statements
-        toC(node->data.program.programItems[j]);
-    } 
-    else if (node->data.program.programItems[j]->type == nodeAssignment) { // Handle assignments
-        toC(node->data.program.programItems[j]);
-    } 
-    else if (node->data.program.programItems[j]->type == nodeReturn) { // Handle return statements
-        toC(node->data.program.programItems[j]);
-        hasReturn = true;
-    } else if (node->data.program.programItems[j]->type == nodeFunctionCall) { // Handle function calls in main
-        toC(node->data.program.programItems[j]);
-    }
-}
-            if (!hasReturn) {
-                addToCodeBuffer("    return 0;\n");
-            }
-            addToCodeBuffer("}\n");
+        case nodeProgram: {
+            uint32_t items = flattenList(node->data.program.programItems, node->data.program.lineCount);
+            flat = flatNewNode(nodeProgram);
+            Ast.left[flat] = items;
             break;
-        
-        case nodeFunctionDef:
-            if (node->data.funcDef.isReturn == 1) {
-                addToCodeBuffer("int ");
-            }
-            else if (node->data.funcDef.isReturn == 0) {
-                addToCodeBuffer("void ");
-            }
-            else { 
-                fprintf(stderr, "IDK what the fuck happened here\n");
-                exit(1);
-            }
-            addToCodeBuffer(node->data.funcDef.identifier);
-            addToCodeBuffer("(");
-
+        }
+        case nodeFunctionDef: {
+            uint32_t stmts = flattenList(node->data.funcDef.stmt, node->data.funcDef.stmtCount);
+            uint32_t params = flatNewList(node->data.funcDef.paramCount);
             for (int i = 0; i < node->data.funcDef.paramCount; i++) {
-                if (i > 0) addToCodeBuffer(", "); 
-                    addToCodeBuffer("int ");
-                    addToCodeBuffer(node->data.funcDef.params[i]);
+                Ast.lists[params + 1 + i] = (uint32_t)node->data.funcDef.params[i];
             }
-            addToCodeBuffer(") {\n");
-
-            // Add the function body
-            for (int j = 0; j < node->data.funcDef.stmtCount; j++) {
-                toC(node->data.funcDef.stmt[j]);
-            }
-            addToCodeBuffer("}\n\n");
+            flat = flatNewNode(nodeFunctionDef);
+            lookupFunction(node->data.funcDef.identifier)->flatDefinition = flat;
+            Ast.sym[flat] = node->data.funcDef.identifier;
+            Ast.left[flat] = stmts;
+            Ast.right[flat] = params;
             break;
-
-        case nodeAssignment:
-            addToCodeBuffer("AssiType ");
-            addToCodeBuffer(node->data.stmt.data.assignment.identifier);
-            addToCodeBuffer(" = ");
-            toC(node->data.assignment.exp);
-            addToCodeBuffer(";\n");
+        }
+        case nodeAssignment: {
+            uint32_t exp = flattenNode(node->data.stmt.data.assignment.exp);
+            flat = flatNewNode(nodeAssignment);
+            Ast.sym[flat] = node->data.stmt.data.assignment.identifier;
+            Ast.left[flat] = exp;
             break;
-
-        case nodePrint:
-            addToCodeBuffer("printf(");
-
-            if (containsFunctionCall(node->data.stmt.data.print.exp)) {
-                addToCodeBuffer("\"%d\\n\"");  
-            } else {
-                // Regular expression handling
-                if (hasOperatorInExpression(node->data.stmt.data.print.exp)) {
-                    addToCodeBuffer("\"%d\\n\"");  
-                } else {
-                    addToCodeBuffer("\"%f\\n\"");  
-            }
         }
-            addToCodeBuffer(", ");
-            toC(node->data.stmt.data.print.exp);
-            addToCodeBuffer(");\n");
+        case nodePrint: {
+            uint32_t exp = flattenNode(node->data.stmt.data.print.exp);
+            flat = flatNewNode(nodePrint);
+            Ast.left[flat] = exp;
             break;
-        case nodeReturn:
-            addToCodeBuffer("return ");
-            toC(node->data.stmt.data.returnStmt.exp);
-            addToCodeBuffer(";\n");
+        }
+        case nodeReturn: {
+            uint32_t exp = flattenNode(node->data.stmt.data.returnStmt.exp);
+            flat = flatNewNode(nodeReturn);
+            Ast.left[flat] = exp;
             break;
-        case nodeExpression:
-            toC(node->data.Expression.lVar);  
-    
-            if (node->data.Expression.oper != NULL) {
-                addToCodeBuffer(node->data.Expression.oper); 
-        } if (node->data.Expression.rVar != NULL) {
-            toC(node->data.Expression.rVar);  
-        } break;
-        case nodeTerm:
-            toC(node->data.term.lVar);  
-            if (node->data.term.oper != NULL) {
-                addToCodeBuffer(node->data.term.oper);  
-            }
-            if (node->data.term.rVar != NULL) {
-                toC(node->data.term.rVar);  
+        }
+        case nodeFunctionCall: {
+            uint32_t args = flattenList(node->data.funcCall.args, node->data.funcCall.argCount);
+            flat = flatNewNode(nodeFunctionCall);
+            Ast.sym[flat] = node->data.funcCall.identifier;
+            Ast.left[flat] = args;
+            if (node->data.funcCall.isStatement) {
+                Ast.flags[flat] |= FLAG_STMT_CALL;
             }
             break;
-        case nodeFunctionCall: 
-            if(node->data.funcCall.identifier == NULL) { 
-                addToCodeBuffer(node->data.stmt.data.funcCall.identifier);
-                addToCodeBuffer("(");
-                for (int i = 0; i < node->data.stmt.data.funcCall.argCount; i++) {
-                    if (i > 0) {
-                        addToCodeBuffer(",");
-                }
-                toC(node->data.stmt.data.funcCall.args[i]);
-                }
-                addToCodeBuffer(");\n"); 
-                break;
+        }
+        case nodeExpression:
+        case nodeTerm: {
+            // long sums are one long left spine, walk down it with the scratch stack instead of recursing
+            int base = ScratchCount;
+            AstNode *spine = node;
+            while (spine->type == nodeExpression || spine->type == nodeTerm) {
+                pushScratch(spine);
+                spine = spine->data.Expression.lVar;
             }
-            else {
-            addToCodeBuffer(node->data.funcCall.identifier);
-            addToCodeBuffer("(");
-            for (int i = 0; i < node->data.funcCall.argCount; i++) {
-                if (i > 0) {
-                    addToCodeBuffer(",");
-                }
-                toC(node->data.funcCall.args[i]);
+            flat = flattenNode(spine);
+
+            // then back up it, each operator node gets numbered after its right operand
+            while (ScratchCount > base) {
+                AstNode *opNode = Scratch[--ScratchCount];
+                uint32_t rVar = flattenNode(opNode->data.Expression.rVar);
+                uint32_t parent = flatNewNode(opNode->type);
+                Ast.oper[parent] = opNode->data.Expression.oper ? opNode->data.Expression.oper[0] : 0;
+                Ast.left[parent] = flat;
+                Ast.right[parent] = rVar;
+                flat = parent;
             }
-            addToCodeBuffer(")"); 
             break;
+        }
+        case nodeFactor: {
+            uint32_t funcCall = flattenNode(node->data.factor.funcCall);
+            uint32_t exp = flattenNode(node->data.factor.exp);
+            flat = flatNewNode(nodeFactor);
+            Ast.sym[flat] = node->data.factor.identifier;
+            Ast.left[flat] = funcCall;
+            Ast.right[flat] = exp;
+            Ast.constant[flat] = node->data.factor.constant;
+            if (!Ast.sym[flat] && funcCall == NO_NODE && exp == NO_NODE) {
+                Ast.literal[flat] = node->data.factor.literal;
             }
+            break;
+        }
+        default:
+            fprintf(stderr, "@ Error: unknown AST node type while flattening: %d\n", node->type);
+            exit(EXIT_FAILURE);
+    }
+    return flat;
+}
+
+// flatten the whole program, returns the root node number
+uint32_t flattenAst(AstNode *program) {
+    flatNewNode(nodeProgram); // burn node 0 so it can mean "no node"
+    return flattenNode(program);
+}
+
+void freeFlatAst() {
+    free(Ast.kind);
+    free(Ast.flags);
+    free(Ast.type);
+    free(Ast.oper);
+    free(Ast.sym);
+    free(Ast.left);
+    free(Ast.right);
+    free(Ast.constant);
+    free(Ast.literal);
+    free(Ast.lists);
+}
 
+// ------------------------------------------- TYPES -------------------------------------- //
+
+// every ML value is a real and comes out in C as a double, but knowing an expression can only ever be a whole
+// number lets print pick its format at compile time instead of checking the value when the program runs.
+// variables, parameters and return values start out as TypeNone and are joined with the type of everything that
+// flows into them: assignments, arguments at every call, return statements. that happens as the walk reaches them,
+// so straight-line code is done in one go. a join that changes something already read earlier in the walk (a
+// parameter, a recursive call's result, x <- x + 1) leaves a stale type behind, so only then does it go round
+// again. types only ever go up, so it always stops.
+// names are shared between functions, so a name used in two places gets one type that covers both
+
+// work out a node's type from its children's, which must already be done
+void computeNodeType(uint32_t node) {
+    uint8_t type = TypeNone;
+    switch (Ast.kind[node]) {
         case nodeFactor:
-            if (node->data.factor.identifier) { 
-                addToCodeBuffer(node->data.factor.identifier);
-            }
-            else if (node->data.factor.funcCall) { 
-                toC(node->data.factor.funcCall);
-            }
-            else if (node->data.factor.exp) { 
-                toC(node->data.factor.exp);
-            }
-            else { 
-                char buffer[50]; 
-                snprintf(buffer, sizeof(buffer), "%.6f", node->data.factor.constant);
-                addToCodeBuffer(buffer);
+            if (Ast.sym[node]) { // variable, never assigned (TypeNone) means it's always 0
+                type = Symbols[Ast.sym[node]].type == TypeReal ? TypeReal : TypeWhole;
+            } else if (Ast.left[node] != NO_NODE) { // call
+                type = Ast.type[Ast.left[node]];
+            } else if (Ast.right[node] != NO_NODE) { // bracketed expression
+                type = Ast.type[Ast.right[node]];
+            } else {
+                type = Ast.constant[node] == trunc(Ast.constant[node]) ? TypeWhole : TypeReal; // trunc() of inf is inf, nan never equals
             }
             break;
 
+        case nodeExpression:
+        case nodeTerm:
+            // whole numbers stay whole under + - *, dividing them doesn't
+            type = Ast.oper[node] != '/' && Ast.type[Ast.left[node]] == TypeWhole && Ast.type[Ast.right[node]] == TypeWhole
+                ? TypeWhole : TypeReal;
+            break;
+
+        case nodeFunctionCall:
+            type = (Ast.flags[node] & FLAG_STMT_CALL) ? TypeNone : lookupFunction(Ast.sym[node])->returnType == TypeReal ? TypeReal : TypeWhole;
+            break;
+
         default:
-            // Handle error or unsupported node types
-            fprintf(stderr, "unknown AST node type: %d\n", node->type);
+            break;
     }
+    Ast.type[node] = type;
 }
 
-// ---------------------------------- REPLACING ASSITYPE ------------------------------//
+// join type into *slot, returns true if that changed it
+bool joinType(uint8_t *slot, uint8_t type) {
+    if (type > *slot) {
+        *slot = type;
+        return true;
+    }
+    return false;
+}
 
-// init struct to store var names and wheth they been operated on
-typedef struct {
-    char* name;
-    int operated; // 1 (true) and 0 (false)
-} VarInf;
-
-// boolean func 
-int isVarFound(const char* line, const char* vari) {
-    const char* pos = line;
-    size_t varLen = strlen(vari);
-    while ((pos = strstr(pos, vari))) {
-        char before = (pos == line) ? ' ' : *(pos - 1);
-        char after = *(pos + varLen);
-        if ((before == ' ' 
-        || before == '=' 
-        || before == '(' 
-        || before == ',' 
-        || before == ';' 
-        || before == '\0') &&
-            (after == ' ' 
-            || after == '=' 
-            || after == ')' 
-            || after == ',' 
-            || after == ';' 
-            || after == '\0')) {
-            return 1; 
-            }
-        pos += varLen;
-        }
-    return 0; 
+// is this one of the argN command line variables?
+bool isArgSymbol(int32_t id) {
+    return Symbols[id].length > 3 && Symbols[id].name[3] >= '0' && Symbols[id].name[3] <= '9';
 }
 
-// will take code and then extract variables in that code with AssiType before it
-int findAssi(const char* buffer, VarInf vars[], int* varCount) {
-    char* buffCpy = strdup(buffer); // duplicate buffer to maintain integrity of orig
-    // init count var
-    int lineCount = 0; 
-    // init lines array
-    char* lines[MAX_LINES];
-    // if we cant copy the buffer we've run out of memory rip
-    if (!buffCpy) {
-        fprintf(stderr, "Memory allocation failed\n");
-        return -1;
+bool *SymbolTypeRead = NULL; // a node this round has already been typed from the name's type
+bool *ReturnTypeRead = NULL; // the same for each function's return type
+
+// join type into a name's type, returns true if something already typed this round saw the old one
+bool joinSymbolType(int32_t id, uint8_t type) {
+    return joinType(&Symbols[id].type, type) && SymbolTypeRead[id];
 }
-    // tokenise each str
-    char* tLine = strtok(buffCpy, "\n");
-    // from there we add each line into the array and we keep track of how many lines stored
-    while (tLine) {
-        lines[lineCount++] = tLine; // tokenised line added to array
-        tLine = strtok(NULL, "\n");
-    }
-    for (int lineIter = 0; lineIter < lineCount; lineIter++) {
-        // within current line AssiType searched
-        char* pl = strstr(lines[lineIter], "AssiType ");
-        if (pl && (strchr(pl, ';') != NULL)) {
-            // if found and semicolon present give memory
-            char* varName = malloc(13); // 12 letters + whitespace
-            sscanf(pl, "AssiType %12[^; ]", varName);
-            vars[*varCount].name = varName;
-            vars[*varCount].operated = 0; 
-            (*varCount)++;
-        }
-    }
-    free(buffCpy);
-    return lineCount;
-}
-
-void checkVarPres(const char* buffer, VarInf vars[], int varCount, int lineCount) {
-    // same as above
-    char* lines[MAX_LINES];
-    char* buffCpy = strdup(buffer);
-    // mem alloc check
-    if (!buffCpy) {
-        fprintf(stderr, "Memory allocation failed\n");
-        return;
-    }
-    // tokenised again
-    char* tLine = strtok(buffCpy, "\n");
-    int iter = 0;
-    
-    while (tLine) {
-        lines[iter++] = tLine;
-        tLine = strtok(NULL, "\n");
-    }
-    // var if there 
-    for (int varIter = 0; varIter < varCount; varIter++) {
-    for (int lineIter = 0; lineIter < lineCount; lineIter++) { // checks var in currLine
-    if (isVarFound(lines[lineIter], vars[varIter].name)) {
-        if (strstr(lines[lineIter], "=")) { // is assign?
-            char* assi = strchr(lines[lineIter], '=');
-            if (assi) {
-                char value[BUFFER_SIZE];
-                sscanf(assi + 1, "%s", value); 
-                if (strchr(value, '.')) { // is float?
-                    vars[varIter].operated = 1;
-                }
+
+// one pass over the whole flat AST. nodes are numbered children first, so going through them in order means every
+// node's children are done before it is, without any recursion, and a function's body before its definition node.
+// returns true if another round is needed
+bool computeTypes() {
+    memset(SymbolTypeRead, 0, sizeof(bool) * (SymbolCount + 1));
+    memset(ReturnTypeRead, 0, sizeof(bool) * FunctionCount);
+    bool stale = false;
+    for (uint32_t node = 1; node < Ast.count; node++) {
+        computeNodeType(node);
+        if (Ast.kind[node] == nodeFactor && Ast.sym[node]) {
+            SymbolTypeRead[Ast.sym[node]] = true;
+        }
+        else if (Ast.kind[node] == nodeAssignment) {
+            stale |= joinSymbolType(Ast.sym[node], Ast.type[Ast.left[node]]);
+        }
+        else if (Ast.kind[node] == nodeFunctionCall) {
+            int32_t f = Symbols[Ast.sym[node]].function;
+            ReturnTypeRead[f] = true;
+            const uint32_t *args = listItems(Ast.left[node]);
+            const uint32_t *params = listItems(Ast.right[Functions[f].flatDefinition]);
+            for (uint32_t i = 0; i < listLength(Ast.left[node]); i++) {
+                stale |= joinSymbolType(params[i], Ast.type[args[i]]);
             }
         }
-        if (strstr(lines[lineIter], "+") || strstr(lines[lineIter], "-") || 
-            strstr(lines[lineIter], "*") || strstr(lines[lineIter], "/")) {
-            vars[varIter].operated = 1; 
+        else if (Ast.kind[node] == nodeFunctionDef) {
+            int32_t f = Symbols[Ast.sym[node]].function;
+            const uint32_t *stmts = listItems(Ast.left[node]);
+            for (uint32_t i = 0; i < listLength(Ast.left[node]); i++) {
+                if (Ast.kind[stmts[i]] == nodeReturn) {
+                    stale |= joinType(&Functions[f].returnType, Ast.type[Ast.left[stmts[i]]]) && ReturnTypeRead[f];
+                }
+            }
         }
     }
+    return stale;
+}
+
+void inferTypes() {
+    for (int32_t id = 1; id <= SymbolCount; id++) {
+        if (isArgSymbol(id)) {
+            Symbols[id].type = TypeReal; // could be anything the user passes in
+        }
     }
+    SymbolTypeRead = zeroedArray(SymbolCount + 1, sizeof(bool));
+    ReturnTypeRead = zeroedArray(FunctionCount, sizeof(bool));
+    while (computeTypes()) {
     }
-    free(buffCpy);
+    free(SymbolTypeRead);
+    free(ReturnTypeRead);
 }
 
-void replAssi(const char* buffer, VarInf vars[], int varCount, char* outBuff) {
-    // copy input buff
-    strcpy(outBuff, buffer); 
-    // iter over vars in array 
-    for (int varIter = 0; varIter < varCount; varIter++) {
-        if (vars[varIter].operated) {
-            char oldStr[BUFFER_SIZE];
-            sprintf(oldStr, "AssiType %s", vars[varIter].name); // make str to use as search for assitype
-            char newStr[BUFFER_SIZE];
-            sprintf(newStr, "%s %s", vars[varIter].operated ? "float" : "int", vars[varIter].name);
-            char* pl = outBuff;
-            // hell of a loop but basically grabs old string and replaces it with new and then shifts and updates pl of chars
-            while ((pl = strstr(pl, oldStr))) {
-                    strncpy(pl, newStr, strlen(newStr));
-                    memmove(pl + strlen(newStr), pl + strlen(oldStr), strlen(pl + strlen(oldStr)) + 1);
-                    pl += strlen(newStr); 
-            }
+// ------------------------------------------- SSA IR -------------------------------------- //
+
+// between the flat AST and the C text sits a small typed SSA form, which is where the optimisation passes work.
+// ML has no branches, so every function (and the top level, which becomes main) is one straight-line block.
+// each instruction defines at most one value and is numbered like a flat AST node; operands are the numbers of
+// instructions earlier in the same block. variables don't survive into it: assigning one just makes its name refer
+// to a value, and reading it refers to that value. reading one that hasn't been assigned yet reads 0
+#define NO_VALUE 0 // instruction 0 is never used, an operand holding 0 is empty
+
+typedef enum {
+    IrConst, // constant, see literal
+    IrArg, // read the command line variable sym
+    IrParam, // the block's parameter sym
+    IrAdd, // a + b
+    IrSub, // a - b
+    IrMul, // a * b
+    IrDiv, // a / b
+    IrCall, // call function sym with the argument list a, TypeNone when the result isn't used
+    IrPrint, // print a
+    IrReturn, // return a, nothing in the block comes after it
+    IrNop // removed by a pass, does nothing
+} IrOp;
+
+typedef struct {
+    uint8_t *op; // IrOp of each instruction
+    uint8_t *type; // ValueType of the value it defines, TypeNone if it doesn't define one
+    int32_t *sym; // argN, parameter or callee symbol id, 0 for everything else
+    int32_t *name; // variable the value was first assigned to, 0 if none. only used to name it in the C
+    uint32_t *a; // first operand, or a call's argument list
+    uint32_t *b; // second operand
+    double *constant; // value of a constant
+    uint32_t *literal; // where a constant's lexeme starts in Source, NO_LITERAL if it was never written in the program
+    uint32_t count; // instructions used, including the unused instruction 0
+    int capacity;
+
+    // call arguments and parameter symbols, laid out like Ast.lists
+    uint32_t *lists;
+    int listCount;
+    int listCapacity;
+} IrCode;
+
+// one block per C function. its instructions are first to first + count - 1
+typedef struct {
+    int32_t symbol; // the function's name, 0 for main
+    uint32_t params; // list in Ir.lists of the parameter symbols
+    uint8_t returnType; // ValueType it returns, TypeNone for void functions and main
+    uint32_t first;
+    uint32_t count;
+    bool removed; // nothing main runs can call it, so it isn't written out
+    bool memoized; // results are cached by the generated program, see emitMemoWrapper()
+} IrBlock;
+
+IrCode Ir; // every instruction of the program
+IrBlock *Blocks = NULL; // Blocks[0] is main, Blocks[f] is the body of Functions[f]
+int BlockCount = 0;
+int BlockCapacity = 0;
+
+uint32_t *NodeValue = NULL; // value each AST node evaluates to, while its block is being built
+uint32_t *VarValue = NULL; // value a variable symbol was last assigned
+int32_t *VarBlock = NULL; // block + 1 that VarValue was set in, anything else means not assigned in this block
+
+uint32_t irListLength(uint32_t list) {
+    return Ir.lists[list];
+}
+
+const uint32_t* irListItems(uint32_t list) {
+    return &Ir.lists[list + 1];
+}
+
+// reserve room for a list of length elements and return its index, the caller fills in the elements
+uint32_t irNewList(uint32_t length) {
+    Ir.lists = growArray(Ir.lists, &Ir.listCapacity, Ir.listCount + length + 1, sizeof(uint32_t));
+    uint32_t list = Ir.listCount;
+    Ir.lists[list] = length;
+    Ir.listCount += length + 1;
+    return list;
+}
+
+// add an instruction to the end of the block being built
+uint32_t irNewValue(IrOp op, uint8_t type) {
+    if ((int)Ir.count == Ir.capacity) { // every array grows together
+        int newCapacity = Ir.capacity ? Ir.capacity * 2 : 1024;
+        Ir.op = resizeArray(Ir.op, newCapacity, sizeof(uint8_t));
+        Ir.type = resizeArray(Ir.type, newCapacity, sizeof(uint8_t));
+        Ir.sym = resizeArray(Ir.sym, newCapacity, sizeof(int32_t));
+        Ir.name = resizeArray(Ir.name, newCapacity, sizeof(int32_t));
+        Ir.a = resizeArray(Ir.a, newCapacity, sizeof(uint32_t));
+        Ir.b = resizeArray(Ir.b, newCapacity, sizeof(uint32_t));
+        Ir.constant = resizeArray(Ir.constant, newCapacity, sizeof(double));
+        Ir.literal = resizeArray(Ir.literal, newCapacity, sizeof(uint32_t));
+        Ir.capacity = newCapacity;
+    }
+    uint32_t value = Ir.count++;
+    Ir.op[value] = op;
+    Ir.type[value] = type;
+    Ir.sym[value] = 0;
+    Ir.name[value] = 0;
+    Ir.a[value] = NO_VALUE;
+    Ir.b[value] = NO_VALUE;
+    Ir.constant[value] = 0;
+    Ir.literal[value] = NO_LITERAL;
+    return value;
+}
+
+// turn an instruction into a constant
+void irMakeConstant(uint32_t value, double constant, uint32_t literal) {
+    Ir.op[value] = IrConst;
+    Ir.type[value] = constant == trunc(constant) ? TypeWhole : TypeReal; // trunc() of inf is inf, nan never equals
+    Ir.name[value] = 0;
+    Ir.constant[value] = constant;
+    Ir.literal[value] = literal;
+}
+
+uint32_t irConstant(double constant, uint32_t literal) {
+    uint32_t value = irNewValue(IrConst, TypeNone);
+    irMakeConstant(value, constant, literal);
+    return value;
+}
+
+// the instruction for an expression or term node's operator
+IrOp irOperator(char oper) {
+    switch (oper) {
+        case '+': return IrAdd;
+        case '-': return IrSub;
+        case '*': return IrMul;
+        default: return IrDiv;
+    }
+}
+
+// the C operator an arithmetic instruction is written with
+char irOperatorChar(uint8_t op) {
+    static const char operators[] = { [IrAdd] = '+', [IrSub] = '-', [IrMul] = '*', [IrDiv] = '/' };
+    return operators[op];
+}
+
+// does the instruction work its value out, rather than just being a constant, argument or parameter?
+bool irComputes(uint32_t value) {
+    return Ir.op[value] != IrConst && Ir.op[value] != IrArg && Ir.op[value] != IrParam;
+}
+
+void irAssign(int32_t block, int32_t symbol, uint32_t value) {
+    VarValue[symbol] = value;
+    VarBlock[symbol] = block + 1;
+}
+
+uint32_t irReadVariable(int32_t block, int32_t symbol) {
+    if (VarBlock[symbol] == block + 1) {
+        return VarValue[symbol];
+    }
+    if (isArgSymbol(symbol)) {
+        uint32_t value = irNewValue(IrArg, TypeReal);
+        Ir.sym[value] = symbol;
+        return value;
+    }
+    return irConstant(0, NO_LITERAL);
+}
+
+// add the instructions for AST nodes first to last to block. a subtree's nodes come just before its root, so
+// going through them in order builds every operand before the instruction using it, left to right, with no
+// recursion. returns false once the block has returned, the rest of it can never run
+bool irBuildNodes(int32_t block, uint32_t first, uint32_t last) {
+    for (uint32_t node = first; node <= last; node++) {
+        uint32_t value = NO_VALUE;
+        switch (Ast.kind[node]) {
+            case nodeFactor:
+                if (Ast.sym[node]) {
+                    value = irReadVariable(block, Ast.sym[node]);
+                } else if (Ast.left[node] != NO_NODE) { // call
+                    value = NodeValue[Ast.left[node]];
+                } else if (Ast.right[node] != NO_NODE) { // bracketed expression
+                    value = NodeValue[Ast.right[node]];
+                } else {
+                    value = irConstant(Ast.constant[node], Ast.literal[node]);
+                }
+                break;
+
+            case nodeExpression:
+            case nodeTerm:
+                value = irNewValue(irOperator(Ast.oper[node]), Ast.type[node]);
+                Ir.a[value] = NodeValue[Ast.left[node]];
+                Ir.b[value] = NodeValue[Ast.right[node]];
+                break;
+
+            case nodeFunctionCall: {
+                uint32_t argCount = listLength(Ast.left[node]);
+                uint32_t args = irNewList(argCount);
+                const uint32_t *astArgs = listItems(Ast.left[node]);
+                for (uint32_t i = 0; i < argCount; i++) {
+                    Ir.lists[args + 1 + i] = NodeValue[astArgs[i]];
+                }
+                value = irNewValue(IrCall, Ast.type[node]);
+                Ir.sym[value] = Ast.sym[node];
+                Ir.a[value] = args;
+                break;
+            }
+
+            case nodeAssignment:
+                value = NodeValue[Ast.left[node]];
+                if (!Ir.name[value] && irComputes(value)) {
+                    Ir.name[value] = Ast.sym[node];
+                }
+                irAssign(block, Ast.sym[node], value);
+                break;
+
+            case nodePrint:
+                value = irNewValue(IrPrint, TypeNone);
+                Ir.a[value] = NodeValue[Ast.left[node]];
+                break;
+
+            case nodeReturn:
+                value = irNewValue(IrReturn, TypeNone);
+                Ir.a[value] = NodeValue[Ast.left[node]];
+                return false;
+
+            default:
+                break;
+        }
+        NodeValue[node] = value;
+    }
+    return true;
+}
+
+// start a new block at the end of Ir, its instructions are everything added until it's closed
+void irStartBlock(int32_t block, int32_t symbol, uint32_t params, uint8_t returnType) {
+    Blocks[block] = (IrBlock){ .symbol = symbol, .params = params, .returnType = returnType, .first = Ir.count };
+}
+
+void irCloseBlock(int32_t block) {
+    Blocks[block].count = Ir.count - Blocks[block].first;
+}
+
+// build a block for every function and one for main from the flat AST
+void buildIr(uint32_t program) {
+    NodeValue = zeroedArray(Ast.count, sizeof(uint32_t));
+    VarValue = zeroedArray(SymbolCount + 1, sizeof(uint32_t));
+    VarBlock = zeroedArray(SymbolCount + 1, sizeof(int32_t));
+    irNewValue(IrConst, TypeNone); // burn instruction 0 so it can mean "no value"
+    BlockCount = FunctionCount ? FunctionCount : 1;
+    Blocks = growArray(Blocks, &BlockCapacity, BlockCount, sizeof(IrBlock));
+
+    // a function's body is the nodes between the item before it and its definition
+    const uint32_t *items = listItems(Ast.left[program]);
+    uint32_t itemCount = listLength(Ast.left[program]);
+    uint32_t first = 1;
+    for (uint32_t i = 0; i < itemCount; i++) {
+        uint32_t definition = items[i];
+        if (Ast.kind[definition] == nodeFunctionDef) {
+            int32_t f = Symbols[Ast.sym[definition]].function;
+            uint8_t returnType = Functions[f].returnsValue ? (Functions[f].returnType == TypeReal ? TypeReal : TypeWhole) : TypeNone;
+            uint32_t paramCount = listLength(Ast.right[definition]);
+            uint32_t params = irNewList(paramCount);
+            irStartBlock(f, Ast.sym[definition], params, returnType);
+            for (uint32_t p = 0; p < paramCount; p++) {
+                int32_t param = (int32_t)listItems(Ast.right[definition])[p];
+                Ir.lists[params + 1 + p] = (uint32_t)param;
+                uint32_t value = irNewValue(IrParam, Symbols[param].type == TypeReal ? TypeReal : TypeWhole);
+                Ir.sym[value] = param;
+                irAssign(f, param, value);
+            }
+            irBuildNodes(f, first, definition - 1);
+            irCloseBlock(f);
+        }
+        first = items[i] + 1;
+    }
+
+    // then main from every other item, in order
+    irStartBlock(0, 0, irNewList(0), TypeNone);
+    first = 1;
+    bool open = true;
+    for (uint32_t i = 0; i < itemCount && open; i++) {
+        if (Ast.kind[items[i]] != nodeFunctionDef) {
+            open = irBuildNodes(0, first, items[i]);
         }
+        first = items[i] + 1;
+    }
+    irCloseBlock(0);
+
+    free(NodeValue);
+    free(VarValue);
+    free(VarBlock);
+}
+
+// passes change blocks in place. an instruction that's no longer needed becomes an IrNop, and if it was replaced
+// by another value its users are sent on to that value as the pass reaches them, with irResolveOperands()
+uint32_t *Forward = NULL; // value each instruction was replaced by, NO_VALUE if it wasn't
+
+void irStartPass() {
+    Forward = zeroedArray(Ir.count, sizeof(uint32_t));
+}
+
+void irEndPass() {
+    free(Forward);
+    Forward = NULL;
+}
+
+void irReplace(uint32_t value, uint32_t with) {
+    Forward[value] = with;
+    Ir.op[value] = IrNop;
+}
+
+uint32_t irResolve(uint32_t value) {
+    while (Forward[value] != NO_VALUE) {
+        value = Forward[value];
+    }
+    return value;
+}
+
+// point an instruction's operands at whatever replaced them
+void irResolveOperands(uint32_t value) {
+    switch (Ir.op[value]) {
+        case IrAdd:
+        case IrSub:
+        case IrMul:
+        case IrDiv:
+            Ir.b[value] = irResolve(Ir.b[value]);
+            // fall through
+        case IrPrint:
+        case IrReturn:
+            Ir.a[value] = irResolve(Ir.a[value]);
+            break;
+        case IrCall: {
+            uint32_t *args = &Ir.lists[Ir.a[value] + 1];
+            for (uint32_t i = 0; i < irListLength(Ir.a[value]); i++) {
+                args[i] = irResolve(args[i]);
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void freeIr() {
+    free(Ir.op);
+    free(Ir.type);
+    free(Ir.sym);
+    free(Ir.name);
+    free(Ir.a);
+    free(Ir.b);
+    free(Ir.constant);
+    free(Ir.literal);
+    free(Ir.lists);
+    free(Blocks);
+}
+
+// ------------------------------------------- FOLDING -------------------------------------- //
+
+// arithmetic on constants is done here rather than in the generated program, and arithmetic that can't change its
+// operand is dropped. runml's doubles behave just like the generated program's, so a folded result is exactly what
+// it would have worked out. only identities that hold for every double (nan, infinities and -0 included) are used
+// unless --fast-math says ordinary numbers are all that matter
+bool FastMath = false; // --fast-math
+
+// what the passes managed, printed by --stats
+bool ShowStats = false; // --stats
+
+typedef struct {
+    int folded; // instructions folded into a constant or replaced by an operand
+    int eliminated; // instructions that repeated an earlier one in their block
+    int dead; // instructions whose value was never used
+    int specialised; // functions copied for the constants they're called with
+    int inlined; // calls replaced by the function's body
+    int unreachable; // functions nothing main runs ever calls
+    int memoized; // functions whose results are cached
+} PassStats;
+
+PassStats Stats;
+
+// is value the constant c? -0 and 0 are told apart
+bool irIsConstant(uint32_t value, double c) {
+    return Ir.op[value] == IrConst && Ir.constant[value] == c && !signbit(Ir.constant[value]) == !signbit(c);
 }
+
+bool irIsZero(uint32_t value) {
+    return Ir.op[value] == IrConst && Ir.constant[value] == 0;
+}
+
+double irArithmetic(uint8_t op, double a, double b) {
+    switch (op) {
+        case IrAdd: return a + b;
+        case IrSub: return a - b;
+        case IrMul: return a * b;
+        default: return a / b;
+    }
 }
-char outBuff[BUFFER_SIZE];
-void conductAssiReplace(const char* buffer) {
-    VarInf vars[MAX_LINES];
-    int varCount = 0;
-    int lineCount = findAssi(buffer, vars, &varCount);
-    checkVarPres(buffer, vars, varCount, lineCount);
-    replAssi(buffer, vars, varCount, outBuff); 
-    for (int varIter = 0; varIter < varCount; varIter++) {
-        free(vars[varIter].name);
+
+// the operand an arithmetic instruction always equals, NO_VALUE if there isn't one
+uint32_t foldIdentity(uint32_t value) {
+    uint32_t a = Ir.a[value];
+    uint32_t b = Ir.b[value];
+    switch (Ir.op[value]) {
+        case IrAdd: // x + 0 is 0 rather than -0 when x is -0, x + -0 is always x
+            if (irIsConstant(b, -0.0) || (FastMath && irIsZero(b))) {
+                return a;
+            }
+            if (irIsConstant(a, -0.0) || (FastMath && irIsZero(a))) {
+                return b;
+            }
+            break;
+        case IrSub:
+            if (irIsConstant(b, 0.0) || (FastMath && irIsZero(b))) {
+                return a;
+            }
+            break;
+        case IrMul:
+            if (irIsConstant(b, 1.0)) {
+                return a;
+            }
+            if (irIsConstant(a, 1.0)) {
+                return b;
+            }
+            break;
+        case IrDiv:
+            if (irIsConstant(b, 1.0)) {
+                return a;
+            }
+            break;
+        default:
+            break;
+    }
+    return NO_VALUE;
+}
+
+// --fast-math only: arithmetic that comes out the same whatever its operands are, as long as they're ordinary
+// numbers. x * 0 is nan for infinite x and -0 for negative x, x - x and x / x are nan for infinite x
+bool foldFastMath(uint32_t value, double *result) {
+    uint32_t a = Ir.a[value];
+    uint32_t b = Ir.b[value];
+    switch (Ir.op[value]) {
+        case IrMul:
+            if (irIsZero(a) || irIsZero(b)) {
+                *result = 0;
+                return true;
+            }
+            break;
+        case IrSub:
+            if (a == b) {
+                *result = 0;
+                return true;
+            }
+            break;
+        case IrDiv:
+            if (a == b) {
+                *result = 1;
+                return true;
+            }
+            break;
+        default:
+            break;
+    }
+    return false;
+}
+
+// fold one block, returns how many instructions went. operands come first, so by the time an instruction is
+// reached anything it uses has already been folded as far as it goes
+int foldBlock(const IrBlock *block) {
+    int removed = 0;
+    for (uint32_t value = block->first; value < block->first + block->count; value++) {
+        irResolveOperands(value);
+        if (Ir.op[value] < IrAdd || Ir.op[value] > IrDiv) {
+            continue;
+        }
+        uint32_t a = Ir.a[value];
+        uint32_t b = Ir.b[value];
+        uint32_t with;
+        double result;
+        if (Ir.op[a] == IrConst && Ir.op[b] == IrConst && isfinite(result = irArithmetic(Ir.op[value], Ir.constant[a], Ir.constant[b]))) {
+            irMakeConstant(value, result, NO_LITERAL); // nan and infinities are left for the generated program to work out
+        } else if (FastMath && foldFastMath(value, &result)) {
+            irMakeConstant(value, result, NO_LITERAL);
+        } else if ((with = foldIdentity(value)) != NO_VALUE) {
+            irReplace(value, with);
+        } else {
+            continue;
+        }
+        removed++;
+    }
+    return removed;
+}
+
+void foldConstants() {
+    irStartPass();
+    for (int b = 0; b < BlockCount; b++) {
+        Stats.folded += foldBlock(&Blocks[b]);
+    }
+    irEndPass();
+}
+
+// ------------------------------------------- VALUE NUMBERING -------------------------------------- //
+
+// an instruction that works out the same thing as one earlier in its block is replaced by that one. operands are
+// values, so two instructions agree when they have the same operator and operands, read the same argN, or call the
+// same pure function with the same arguments (a pure function can't do anything but return a value, so calling
+// it twice gets nothing more). candidates are found through a hash table of the instructions seen so far
+
+uint32_t *CseTable = NULL; // open addressing, NO_VALUE is an empty slot
+uint32_t CseCapacity = 0; // a power of two
+
+bool irCommutes(uint8_t op) {
+    return op == IrAdd || op == IrMul;
+}
+
+bool isCseCandidate(uint32_t value) {
+    switch (Ir.op[value]) {
+        case IrAdd:
+        case IrSub:
+        case IrMul:
+        case IrDiv:
+        case IrArg:
+        case IrConst: // every constant is its own instruction, so equal ones have to be matched up first
+            return true;
+        case IrCall:
+            return Ir.type[value] != TypeNone && isPureFunction(lookupFunction(Ir.sym[value]));
+        default:
+            return false;
+    }
+}
+
+uint32_t mixHash(uint32_t hash, uint32_t word) {
+    return (hash ^ word) * 16777619u;
+}
+
+// spread every bit into the low ones before the hash is masked, value ids are nearly consecutive and one FNV
+// multiply on its own leaves them in a handful of slots
+uint32_t finishHash(uint32_t hash) {
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+uint32_t hashInstruction(uint32_t value) {
+    uint32_t hash = mixHash(2166136261u, Ir.op[value]);
+    hash = mixHash(hash, (uint32_t)Ir.sym[value]);
+    if (Ir.op[value] == IrCall) {
+        const uint32_t *args = irListItems(Ir.a[value]);
+        for (uint32_t i = 0; i < irListLength(Ir.a[value]); i++) {
+            hash = mixHash(hash, args[i]);
+        }
+    } else if (Ir.op[value] == IrConst) {
+        uint64_t bits;
+        memcpy(&bits, &Ir.constant[value], sizeof bits);
+        hash = mixHash(mixHash(hash, (uint32_t)bits), (uint32_t)(bits >> 32));
+    } else if (irCommutes(Ir.op[value]) && Ir.b[value] < Ir.a[value]) { // so a + b and b + a end up in the same place
+        hash = mixHash(mixHash(hash, Ir.b[value]), Ir.a[value]);
+    } else {
+        hash = mixHash(mixHash(hash, Ir.a[value]), Ir.b[value]);
+    }
+    return finishHash(hash);
+}
+
+bool sameInstruction(uint32_t x, uint32_t y) {
+    if (Ir.op[x] != Ir.op[y] || Ir.sym[x] != Ir.sym[y]) {
+        return false;
+    }
+    if (Ir.op[x] == IrCall) {
+        uint32_t length = irListLength(Ir.a[x]);
+        return length == irListLength(Ir.a[y])
+            && memcmp(irListItems(Ir.a[x]), irListItems(Ir.a[y]), sizeof(uint32_t) * length) == 0;
+    }
+    if (Ir.op[x] == IrConst) { // bit for bit, -0 isn't 0
+        return memcmp(&Ir.constant[x], &Ir.constant[y], sizeof(double)) == 0;
+    }
+    if (Ir.a[x] == Ir.a[y] && Ir.b[x] == Ir.b[y]) {
+        return true;
+    }
+    return irCommutes(Ir.op[x]) && Ir.a[x] == Ir.b[y] && Ir.b[x] == Ir.a[y];
+}
+
+// value number one block, returns how many instructions were found to repeat an earlier one
+int numberBlock(const IrBlock *block) {
+    uint32_t capacity = 16;
+    while (capacity < block->count * 2) {
+        capacity *= 2;
+    }
+    if (capacity > CseCapacity) {
+        CseTable = resizeArray(CseTable, capacity, sizeof(uint32_t));
+        CseCapacity = capacity;
+    }
+    memset(CseTable, 0, sizeof(uint32_t) * capacity);
+
+    int eliminated = 0;
+    for (uint32_t value = block->first; value < block->first + block->count; value++) {
+        irResolveOperands(value);
+        if (!isCseCandidate(value)) {
+            continue;
+        }
+        uint32_t slot = hashInstruction(value) & (capacity - 1);
+        while (CseTable[slot] != NO_VALUE && !sameInstruction(CseTable[slot], value)) {
+            slot = (slot + 1) & (capacity - 1);
+        }
+        if (CseTable[slot] == NO_VALUE) {
+            CseTable[slot] = value;
+        } else {
+            eliminated += irComputes(value); // constants are written in place anyway, they don't count
+            irReplace(value, CseTable[slot]);
+        }
+    }
+    return eliminated;
+}
+
+void eliminateCommonSubexpressions() {
+    irStartPass();
+    for (int b = 0; b < BlockCount; b++) {
+        Stats.eliminated += numberBlock(&Blocks[b]);
+    }
+    irEndPass();
+    free(CseTable);
+    CseTable = NULL;
+    CseCapacity = 0;
+}
+
+// ------------------------------------------- DEAD CODE -------------------------------------- //
+
+// anything whose value never reaches a print, a return or a call that does something is dropped. in SSA a dead
+// store is just a value nobody uses, so one walk backwards through each block finds them all: print, return and
+// calls to impure functions are live, and so is every operand of something live. a variable that's only ever
+// assigned dead values disappears with them, and so does an unread argN's global
+
+bool *LiveValue = NULL;
+
+bool isLiveRoot(uint32_t value) {
+    switch (Ir.op[value]) {
+        case IrPrint:
+        case IrReturn:
+            return true;
+        case IrCall:
+            return !isPureFunction(lookupFunction(Ir.sym[value]));
+        default:
+            return false;
+    }
+}
+
+void markOperandsLive(uint32_t value) {
+    switch (Ir.op[value]) {
+        case IrAdd:
+        case IrSub:
+        case IrMul:
+        case IrDiv:
+            LiveValue[Ir.b[value]] = true;
+            // fall through
+        case IrPrint:
+        case IrReturn:
+            LiveValue[Ir.a[value]] = true;
+            break;
+        case IrCall: {
+            const uint32_t *args = irListItems(Ir.a[value]);
+            for (uint32_t i = 0; i < irListLength(Ir.a[value]); i++) {
+                LiveValue[args[i]] = true;
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// returns how many instructions in the block were dead
+int sweepBlock(const IrBlock *block) {
+    int removed = 0;
+    for (uint32_t value = block->first + block->count; value-- > block->first;) {
+        if (LiveValue[value] || isLiveRoot(value)) {
+            if (!LiveValue[value] && Ir.op[value] == IrCall) {
+                Ir.type[value] = TypeNone; // only called for what it does, so it's written as a statement
+            }
+            markOperandsLive(value);
+        } else if (Ir.op[value] != IrNop && Ir.op[value] != IrParam) { // parameters stay, they're part of the signature
+            removed += irComputes(value);
+            Ir.op[value] = IrNop;
+        }
+    }
+    return removed;
+}
+
+void eliminateDeadCode() {
+    LiveValue = zeroedArray(Ir.count, sizeof(bool));
+    for (int b = 0; b < BlockCount; b++) {
+        Stats.dead += sweepBlock(&Blocks[b]);
+    }
+    free(LiveValue);
+    LiveValue = NULL;
+}
+
+// ------------------------------------------- INLINING -------------------------------------- //
+
+// a call to a small function that doesn't call itself is replaced by a copy of the function's body, with its
+// parameters standing for the call's arguments and its return value standing for the call. a function can only
+// call those defined before it (and itself), so going through the blocks in order means every callee has had its
+// own calls inlined before anything inlines it. a block that inlines something is copied to the end of Ir with the
+// callee's instructions spliced in where the call was, and the old copy is left behind
+#define INLINE_MAX_SIZE 12 // most instructions that do something a function can have and still be inlined
+
+uint32_t *Remap = NULL; // value each instruction of the block being copied has in the copy
+
+bool *Inlinable = NULL; // per block, decided once the block has had its own calls inlined rather than at every call
+int *InlinedCalls = NULL; // how many calls to each function were inlined, for --stats
+int InlinedCallsCount = 0; // functions there were when it was made, copies made after can't have been inlined
+
+// instructions in a block that end up as C statements
+uint32_t blockSize(const IrBlock *block) {
+    uint32_t size = 0;
+    for (uint32_t value = block->first; value < block->first + block->count; value++) {
+        size += Ir.op[value] != IrNop && irComputes(value);
+    }
+    return size;
+}
+
+bool isInlinable(int32_t function) {
+    return !(Functions[function].flags & FUNC_RECURSIVE) && blockSize(&Blocks[function]) <= INLINE_MAX_SIZE;
+}
+
+// add a copy of an instruction to the end of Ir with its operands mapped through Remap
+uint32_t irCopyValue(uint32_t value) {
+    uint32_t copy = irNewValue(Ir.op[value], Ir.type[value]);
+    Ir.sym[copy] = Ir.sym[value];
+    Ir.name[copy] = Ir.name[value];
+    Ir.constant[copy] = Ir.constant[value];
+    Ir.literal[copy] = Ir.literal[value];
+    if (Ir.op[value] == IrCall) {
+        uint32_t argCount = irListLength(Ir.a[value]);
+        uint32_t args = irNewList(argCount);
+        for (uint32_t i = 0; i < argCount; i++) {
+            Ir.lists[args + 1 + i] = Remap[Ir.lists[Ir.a[value] + 1 + i]];
+        }
+        Ir.a[copy] = args;
+    } else if (Ir.op[value] >= IrAdd) { // constants, arguments and parameters have no operands
+        Ir.a[copy] = Remap[Ir.a[value]];
+        Ir.b[copy] = Remap[Ir.b[value]];
+    }
+    return copy;
+}
+
+// splice a copy of the callee's body in for call, returns the value it returns (NO_VALUE for a void function)
+uint32_t inlineCall(uint32_t call, const IrBlock *callee) {
+    uint32_t result = NO_VALUE;
+    uint32_t param = 0;
+    for (uint32_t value = callee->first; value < callee->first + callee->count; value++) {
+        switch (Ir.op[value]) {
+            case IrNop:
+                break;
+            case IrParam: // parameters are in order at the top of the block
+                Remap[value] = Remap[Ir.lists[Ir.a[call] + 1 + param++]];
+                break;
+            case IrReturn:
+                result = Remap[Ir.a[value]];
+                break;
+            default:
+                Remap[value] = irCopyValue(value);
+        }
+    }
+    return result;
+}
+
+// copy a block to the end of Ir with calls to small functions inlined, returns how many were
+int inlineBlock(IrBlock *block) {
+    Remap = resizeArray(Remap, Ir.count, sizeof(uint32_t));
+    Remap[NO_VALUE] = NO_VALUE;
+    uint32_t first = Ir.count;
+    int firstList = Ir.listCount;
+    uint32_t end = block->first + block->count;
+    int inlined = 0;
+    for (uint32_t value = block->first; value < end; value++) {
+        if (Ir.op[value] == IrNop) {
+            continue;
+        }
+        int32_t callee = Ir.op[value] == IrCall ? Symbols[Ir.sym[value]].function : 0;
+        if (callee && callee != block - Blocks && Inlinable[callee]) {
+            Remap[value] = inlineCall(value, &Blocks[callee]);
+            InlinedCalls[callee]++;
+            inlined++;
+        } else {
+            Remap[value] = irCopyValue(value);
+        }
+    }
+    if (inlined) {
+        block->first = first;
+        block->count = Ir.count - first;
+    } else { // nothing changed, forget the copy and the argument lists made for it
+        Ir.count = first;
+        Ir.listCount = firstList;
+    }
+    return inlined;
+}
+
+void inlineFunctions() {
+    InlinedCalls = zeroedArray(BlockCount, sizeof(int));
+    InlinedCallsCount = BlockCount;
+    Inlinable = zeroedArray(BlockCount, sizeof(bool));
+    for (int b = 1; b < BlockCount; b++) {
+        Stats.inlined += inlineBlock(&Blocks[b]);
+        Inlinable[b] = isInlinable(b);
     }
+    Stats.inlined += inlineBlock(&Blocks[0]);
+    free(Inlinable);
+    Inlinable = NULL;
+    free(Remap);
+    Remap = NULL;
+}
+
+// ------------------------------------------- SPECIALISATION -------------------------------------- //
+
+// a function called often enough with the same constants for some of its arguments gets a copy of its own for
+// them: the constants go straight into the copy's body in place of those parameters, and the calls pass only the
+// arguments that still vary. folding then has constants to work with inside the copy. copies are new functions,
+// named function_specN, and are set up exactly like the ones in the program so every later pass treats them the same
+#define SPECIALISE_MIN_CALLS 3 // calls with the same constant arguments a function needs before it's copied for them
+
+typedef struct {
+    uint32_t call; // first call with these constant arguments
+    int count; // calls with them
+    int32_t clone; // function made for them, 0 if there weren't enough calls
+} Specialisation;
+
+Specialisation *Specialisations = NULL; // open addressing, call is NO_VALUE in an empty slot
+uint32_t SpecialisationCapacity = 0;
+
+int *SpecialisedCalls = NULL; // calls sent to each specialised copy, for --stats
+
+// does the call pass a constant for anything?
+bool hasConstantArgument(uint32_t call) {
+    for (uint32_t i = 0; i < irListLength(Ir.a[call]); i++) {
+        if (Ir.op[irListItems(Ir.a[call])[i]] == IrConst) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// the function and constants a call passes, anything else it passes doesn't matter
+uint32_t hashConstantArguments(uint32_t call) {
+    uint32_t hash = mixHash(2166136261u, (uint32_t)Ir.sym[call]);
+    for (uint32_t i = 0; i < irListLength(Ir.a[call]); i++) {
+        uint32_t arg = irListItems(Ir.a[call])[i];
+        uint64_t bits = UINT64_MAX; // so it matters which arguments are constant
+        if (Ir.op[arg] == IrConst) {
+            memcpy(&bits, &Ir.constant[arg], sizeof bits);
+        }
+        hash = mixHash(mixHash(hash, (uint32_t)bits), (uint32_t)(bits >> 32));
+    }
+    return finishHash(hash);
+}
+
+// do two calls go to the same function with the same constants in the same places? compared bit for bit
+bool sameConstantArguments(uint32_t x, uint32_t y) {
+    if (Ir.sym[x] != Ir.sym[y]) {
+        return false;
+    }
+    for (uint32_t i = 0; i < irListLength(Ir.a[x]); i++) {
+        uint32_t a = irListItems(Ir.a[x])[i];
+        uint32_t b = irListItems(Ir.a[y])[i];
+        if ((Ir.op[a] == IrConst) != (Ir.op[b] == IrConst)
+            || (Ir.op[a] == IrConst && memcmp(&Ir.constant[a], &Ir.constant[b], sizeof(double)) != 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// make a copy of function for the constants call passes, returns the copy's index in Functions and Blocks
+int32_t cloneFunction(int32_t function, uint32_t call) {
+    char name[64];
+    snprintf(name, sizeof name, "%.40s_spec%d", symName(Blocks[function].symbol), FunctionCount);
+    int32_t symbol = internSymbol(name, strlen(name));
+
+    Functions = growArray(Functions, &FunctionCapacity, FunctionCount + 1, sizeof(FunctionInfo));
+    int32_t clone = FunctionCount++;
+    Functions[clone] = Functions[function];
+    Functions[clone].symbol = symbol;
+    Symbols[symbol].function = clone;
+    Blocks = growArray(Blocks, &BlockCapacity, BlockCount + 1, sizeof(IrBlock));
+    BlockCount++;
+
+    // the parameters that are left are the ones the call doesn't pass a constant for
+    uint32_t argCount = irListLength(Ir.a[call]);
+    uint32_t keptCount = 0;
+    for (uint32_t i = 0; i < argCount; i++) {
+        keptCount += Ir.op[irListItems(Ir.a[call])[i]] != IrConst;
+    }
+    uint32_t params = irNewList(keptCount);
+    irStartBlock(clone, symbol, params, Blocks[function].returnType);
+    Functions[clone].arity = (int)keptCount;
+
+    Remap = resizeArray(Remap, Ir.count + argCount + Blocks[function].count, sizeof(uint32_t));
+    Remap[NO_VALUE] = NO_VALUE;
+    const IrBlock *body = &Blocks[function];
+    uint32_t param = 0;
+    uint32_t kept = 0;
+    for (uint32_t value = body->first; value < body->first + body->count; value++) {
+        if (Ir.op[value] == IrNop) {
+            continue;
+        }
+        if (Ir.op[value] == IrParam) { // in order at the top of the block
+            uint32_t arg = Ir.lists[Ir.a[call] + 1 + param++];
+            if (Ir.op[arg] == IrConst) {
+                Remap[value] = irConstant(Ir.constant[arg], Ir.literal[arg]);
+                continue;
+            }
+            Ir.lists[params + 1 + kept++] = (uint32_t)Ir.sym[value];
+        }
+        Remap[value] = irCopyValue(value);
+    }
+    irCloseBlock(clone);
+    return clone;
+}
+
+// send a call to a copy, passing only the arguments that aren't built into it
+void redirectCall(uint32_t call, int32_t clone) {
+    uint32_t keptCount = 0;
+    for (uint32_t i = 0; i < irListLength(Ir.a[call]); i++) {
+        keptCount += Ir.op[irListItems(Ir.a[call])[i]] != IrConst;
+    }
+    uint32_t args = irNewList(keptCount);
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < irListLength(Ir.a[call]); i++) {
+        uint32_t arg = Ir.lists[Ir.a[call] + 1 + i];
+        if (Ir.op[arg] != IrConst) {
+            Ir.lists[args + 1 + kept++] = arg;
+        }
+    }
+    Ir.sym[call] = Functions[clone].symbol;
+    Ir.a[call] = args;
+    SpecialisedCalls[clone]++;
+}
+
+void specialiseFunctions() {
+    // find the calls with constant arguments, and how many share the same ones
+    uint32_t *calls = NULL;
+    uint32_t *slots = NULL;
+    int callCount = 0;
+    int callCapacity = 0;
+    int slotCapacity = 0;
+    for (int b = 0; b < BlockCount; b++) {
+        for (uint32_t value = Blocks[b].first; value < Blocks[b].first + Blocks[b].count; value++) {
+            if (Ir.op[value] == IrCall && hasConstantArgument(value)) {
+                calls = growArray(calls, &callCapacity, callCount + 1, sizeof(uint32_t));
+                calls[callCount++] = value;
+            }
+        }
+    }
+    slots = growArray(slots, &slotCapacity, callCount ? callCount : 1, sizeof(uint32_t));
+    SpecialisationCapacity = 16;
+    while (SpecialisationCapacity < (uint32_t)callCount * 2) {
+        SpecialisationCapacity *= 2;
+    }
+    Specialisations = zeroedArray(SpecialisationCapacity, sizeof(Specialisation));
+    for (int i = 0; i < callCount; i++) {
+        uint32_t slot = hashConstantArguments(calls[i]) & (SpecialisationCapacity - 1);
+        while (Specialisations[slot].call != NO_VALUE && !sameConstantArguments(Specialisations[slot].call, calls[i])) {
+            slot = (slot + 1) & (SpecialisationCapacity - 1);
+        }
+        if (Specialisations[slot].call == NO_VALUE) {
+            Specialisations[slot].call = calls[i];
+        }
+        Specialisations[slot].count++;
+        slots[i] = slot;
+    }
+
+    // copy the functions for the ones common enough, then point their calls at the copies
+    for (uint32_t slot = 0; slot < SpecialisationCapacity; slot++) {
+        if (Specialisations[slot].count >= SPECIALISE_MIN_CALLS) {
+            uint32_t call = Specialisations[slot].call;
+            Specialisations[slot].clone = cloneFunction(Symbols[Ir.sym[call]].function, call);
+            Stats.specialised++;
+        }
+    }
+    SpecialisedCalls = zeroedArray(BlockCount, sizeof(int));
+    for (int i = 0; i < callCount; i++) {
+        if (Specialisations[slots[i]].clone) {
+            redirectCall(calls[i], Specialisations[slots[i]].clone);
+        }
+    }
+
+    free(calls);
+    free(slots);
+    free(Specialisations);
+    Specialisations = NULL;
+    free(Remap);
+    Remap = NULL;
+}
+
+// ------------------------------------------- REACHABILITY -------------------------------------- //
+
+// only functions main can end up calling are written out, so the C gcc has to get through grows with what the
+// program uses rather than with everything it defines. runs last, calls the other passes dropped don't count
+
+// returns how many functions were dropped
+int removeUnreachableFunctions() {
+    int32_t *work = resizeArray(NULL, BlockCount, sizeof(int32_t));
+    bool *reached = zeroedArray(BlockCount, sizeof(bool));
+    int workCount = 0;
+    reached[0] = true;
+    work[workCount++] = 0;
+    while (workCount > 0) {
+        const IrBlock *block = &Blocks[work[--workCount]];
+        for (uint32_t value = block->first; value < block->first + block->count; value++) {
+            if (Ir.op[value] == IrCall) {
+                int32_t callee = Symbols[Ir.sym[value]].function;
+                if (!reached[callee]) {
+                    reached[callee] = true;
+                    work[workCount++] = callee;
+                }
+            }
+        }
+    }
+
+    int removed = 0;
+    for (int b = 1; b < BlockCount; b++) {
+        if (!reached[b] && !Blocks[b].removed) {
+            Blocks[b].removed = true;
+            removed++;
+        }
+    }
+    free(work);
+    free(reached);
+    return removed;
+}
+
+// ------------------------------------------- MEMOIZATION -------------------------------------- //
+
+// a pure function always returns the same thing for the same arguments, so its results can be kept and looked up
+// rather than worked out again. that pays off for functions that call themselves more than once, which otherwise
+// redo the same calls exponentially many times; those are memoized on their own, --memoize does every pure one.
+// the cache itself is written into the generated program by emitMemoWrapper()
+bool MemoizeAll = false; // --memoize
+
+// does the function still call itself from more than one place after the other passes?
+bool isHotFunction(int32_t function) {
+    const IrBlock *block = &Blocks[function];
+    int selfCalls = 0;
+    for (uint32_t value = block->first; value < block->first + block->count; value++) {
+        selfCalls += Ir.op[value] == IrCall && Symbols[Ir.sym[value]].function == function;
+    }
+    return selfCalls > 1;
+}
+
+// returns how many functions were picked
+int chooseMemoized() {
+    int chosen = 0;
+    for (int b = 1; b < BlockCount; b++) {
+        if (!Blocks[b].removed && Blocks[b].returnType != TypeNone && isPureFunction(&Functions[b])
+            && (MemoizeAll || isHotFunction(b))) {
+            Blocks[b].memoized = true;
+            chosen++;
+        }
+    }
+    return chosen;
+}
+
+// run the passes over every block, in an order where each one leaves the next more to do
+void optimiseIr() {
+    foldConstants();
+    eliminateCommonSubexpressions();
+    inlineFunctions();
+    specialiseFunctions(); // the small functions have gone, what's left is worth a copy
+    foldConstants(); // specialised and inlined bodies usually have constants to fold and repeats to find
+    eliminateCommonSubexpressions();
+    eliminateDeadCode();
+    Stats.unreachable += removeUnreachableFunctions();
+    Stats.memoized += chooseMemoized();
+}
+
+void printStats() {
+    fprintf(stderr, "@ fold: %d instruction(s) removed\n", Stats.folded);
+    fprintf(stderr, "@ cse: %d expression(s) eliminated\n", Stats.eliminated);
+    fprintf(stderr, "@ dead: %d instruction(s) removed\n", Stats.dead);
+    fprintf(stderr, "@ specialise: %d function(s) copied\n", Stats.specialised);
+    for (int b = 1; b < BlockCount; b++) {
+        if (SpecialisedCalls[b]) {
+            fprintf(stderr, "@     %s for %d call(s)\n", symName(Blocks[b].symbol), SpecialisedCalls[b]);
+        }
+    }
+    fprintf(stderr, "@ inline: %d call(s) inlined\n", Stats.inlined);
+    for (int b = 1; b < InlinedCallsCount; b++) {
+        if (InlinedCalls[b]) {
+            fprintf(stderr, "@     %d call(s) to %s\n", InlinedCalls[b], symName(Blocks[b].symbol));
+        }
+    }
+    fprintf(stderr, "@ unreachable: %d function(s) removed\n", Stats.unreachable);
+    fprintf(stderr, "@ memoize: %d function(s) memoized\n", Stats.memoized);
+    for (int b = 1; b < BlockCount; b++) {
+        if (Blocks[b].memoized) {
+            fprintf(stderr, "@     %s\n", symName(Blocks[b].symbol));
+        }
+    }
+}
+
+// ------------------------------------------- INTERPRETER-------------------------------------- //
+
+//declare interpreter buffer size
+#define BUFFER_SIZE 10000 // may change
+
+// the generated C is built up in one growable buffer. it knows where its end is so appending never rescans what's
+// already there, and it doubles when it fills up so the total copying stays linear in the size of the output
+char* codeBuffer; // Global buffer for C code, always null-terminated
+size_t bufferLength = 0; // characters in the buffer, not counting the terminator
+size_t bufferCapacity = 0; // bytes allocated
+
+// Free the buffer
+void freeBuffer() {
+    free(codeBuffer);
+}
+
+// make room for extra more characters and the terminator
+void reserveCodeBuffer(size_t extra) {
+    if (bufferLength + extra < bufferCapacity) {
+        return;
+    }
+    size_t newCapacity = bufferCapacity ? bufferCapacity : BUFFER_SIZE;
+    while (newCapacity <= bufferLength + extra) {
+        newCapacity *= 2;
+    }
+    char* newBuffer = realloc(codeBuffer, newCapacity);
+    if (!newBuffer) {
+        fprintf(stderr, "Memory reallocation failed\n");
+        freeBuffer(); // Clean up existing buffer
+        exit(1);
+    }
+    codeBuffer = newBuffer;
+    bufferCapacity = newCapacity;
+}
+
+// Initialize buffer
+void initBuffer() {
+    reserveCodeBuffer(0);
+    codeBuffer[0] = '\0'; // Start with an empty string
+}
+
+// append length characters of str
+void addToCodeBufferN(const char* str, size_t length) {
+    reserveCodeBuffer(length);
+    memcpy(codeBuffer + bufferLength, str, length);
+    bufferLength += length;
+    codeBuffer[bufferLength] = '\0';
+}
+
+void addToCodeBuffer(const char* str) {
+    addToCodeBufferN(str, strlen(str));
+}
+
+void addCharToCodeBuffer(char c) {
+    reserveCodeBuffer(1);
+    codeBuffer[bufferLength++] = c;
+    codeBuffer[bufferLength] = '\0';
+}
+
+// names know their own length, no need to strlen() them
+void addSymbolToCodeBuffer(int32_t id) {
+    addToCodeBufferN(Symbols[id].name, Symbols[id].length);
+}
+
+// printf onto the end of the buffer, formatted straight into the free space rather than into a temporary string
+void addFormatToCodeBuffer(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(codeBuffer + bufferLength, bufferCapacity - bufferLength, format, args);
+    va_end(args);
+    if (length < 0) {
+        return;
+    }
+    if ((size_t)length >= bufferCapacity - bufferLength) { // didn't fit, grow and do it again
+        reserveCodeBuffer(length);
+        va_start(args, format);
+        vsnprintf(codeBuffer + bufferLength, bufferCapacity - bufferLength, format, args);
+        va_end(args);
+    }
+    bufferLength += length;
+}
+
+void writeCFile() {
+    FILE *cFile = fopen("mlProgram.c", "w");
+    if (cFile == NULL) {
+        fprintf(stderr, "! Error: Could not create C file\n");
+        return;
+    }
+    fprintf(cFile, "%s", codeBuffer); // buffer to file
+    fclose(cFile);
+}
+
+#define CONSTANT_TEXT_SIZE 64 // room formatConstant() needs
+
+// write the shortest decimal that reads back as exactly value, always as a double constant as far as C is concerned
+void formatDouble(double value, char *buffer, size_t size) {
+    if (isinf(value)) { // only from a literal with hundreds of digits
+        snprintf(buffer, size, value < 0 ? "(-1e999)" : "1e999");
+        return;
+    }
+    for (int precision = 15; precision <= 17; precision++) {
+        snprintf(buffer, size, "%.*g", precision, value);
+        if (strtod(buffer, NULL) == value) {
+            break;
+        }
+    }
+    if (!strpbrk(buffer, ".e")) {
+        strncat(buffer, ".0", size - strlen(buffer) - 1);
+    }
+}
+
+// write a constant for C so gcc ends up with the same double we have, bit for bit.
+// a literal from the program is copied over with its leading and trailing zeros trimmed, no formatting needed.
+// with at most 15 significant digits that is already the shortest decimal for the double (doubles tell all
+// 15 digit decimals apart). longer ones, and constants that never came from the source, get formatDouble()
+void formatConstant(double value, uint32_t literal, char *buffer, size_t size) {
+    if (literal != NO_LITERAL) {
+        const char *text = Source + literal;
+        const char *end = text;
+        while (end < Source + SourceLength && ((*end >= '0' && *end <= '9') || *end == '.')) {
+            end++;
+        }
+        const char *point = memchr(text, '.', end - text);
+        const char *wholeEnd = point ? point : end;
+        const char *fractionEnd = end;
+        while (text < wholeEnd - 1 && *text == '0') { // keep one digit before the point
+            text++;
+        }
+        while (point && fractionEnd > point + 1 && fractionEnd[-1] == '0') {
+            fractionEnd--;
+        }
+
+        int significant = 0;
+        bool leading = true;
+        for (const char *c = text; c < fractionEnd; c++) {
+            if (*c != '.' && !(leading && *c == '0')) {
+                leading = false;
+                significant++;
+            }
+        }
+        size_t wholeLength = wholeEnd - text;
+        size_t fractionLength = point && fractionEnd > point + 1 ? fractionEnd - point - 1 : 0;
+        if (significant <= 15 && wholeLength + fractionLength + 3 <= size) {
+            memcpy(buffer, text, wholeLength);
+            buffer[wholeLength] = '.';
+            if (fractionLength) {
+                memcpy(buffer + wholeLength + 1, point + 1, fractionLength);
+            } else {
+                buffer[wholeLength + 1] = '0';
+                fractionLength = 1;
+            }
+            buffer[wholeLength + 1 + fractionLength] = '\0';
+            return;
+        }
+    }
+    if (signbit(value)) { // so "x - -2" doesn't come out as x--2
+        buffer[0] = '(';
+        formatDouble(value, buffer + 1, size - 2);
+        strcat(buffer, ")");
+        return;
+    }
+    formatDouble(value, buffer, size);
+}
+
+// goes at the top of the generated program if it prints anything that might not be a whole number.
+// whole numbers come out without decimal places and anything else with 6, beyond 2^53 every double is whole
+#define PRINT_REAL_FUNCTION \
+    "void printReal(double value) {\n" \
+    "    if (value != value || value < -9007199254740992.0 || value > 9007199254740992.0 || value == (double)(long long)value) {\n" \
+    "        printf(\"%.0f\\n\", value);\n" \
+    "    } else {\n" \
+    "        printf(\"%.6f\\n\", value);\n" \
+    "    }\n" \
+    "}\n\n"
+
+// write a value where an instruction uses it. constants, arguments and parameters are written in place,
+// everything else has its own C variable, named after the ML variable it was assigned to when there is one.
+// ML names are only letters, so every one that reaches C gets a suffix to keep it clear of C keywords, the C
+// library and each other: values are name_N or tN, parameters name_p and functions name_f. the argN globals
+// already have a digit in them and keep their names
+void emitValue(uint32_t value) {
+    switch (Ir.op[value]) {
+        case IrConst: // formatted straight into the buffer
+            reserveCodeBuffer(CONSTANT_TEXT_SIZE);
+            formatConstant(Ir.constant[value], Ir.literal[value], codeBuffer + bufferLength, CONSTANT_TEXT_SIZE);
+            bufferLength += strlen(codeBuffer + bufferLength);
+            break;
+        case IrArg:
+            addSymbolToCodeBuffer(Ir.sym[value]);
+            break;
+        case IrParam:
+            addFormatToCodeBuffer("%s_p", symName(Ir.sym[value]));
+            break;
+        default:
+            if (Ir.name[value]) {
+                addFormatToCodeBuffer("%s_%u", symName(Ir.name[value]), value);
+            } else {
+                addFormatToCodeBuffer("t%u", value);
+            }
+    }
+}
+
+// the C declaration of a block's function with suffix on its name, without the ; or {
+void emitSignature(const IrBlock *block, const char *suffix) {
+    addFormatToCodeBuffer("%s %s_f%s(", block->returnType != TypeNone ? "double" : "void", symName(block->symbol), suffix);
+    const uint32_t *params = irListItems(block->params);
+    for (uint32_t i = 0; i < irListLength(block->params); i++) {
+        addFormatToCodeBuffer(i > 0 ? ", double %s_p" : "double %s_p", symName((int32_t)params[i]));
+    }
+    if (!irListLength(block->params)) {
+        addToCodeBuffer("void");
+    }
+    addCharToCodeBuffer(')');
+}
+
+// helpers for memoized functions, at the top of the generated program if there are any. a function's arguments
+// are its key, compared bit for bit, so -0 and 0 are different calls just like they can be to the function
+#define MEMO_FUNCTIONS \
+    "#define MEMO_SLOTS 4096 // entries in each function's cache, a power of two\n" \
+    "#define MEMO_PROBES 8 // slots looked at before giving up and taking the first one\n\n" \
+    "unsigned long long memoBits(double value) {\n" \
+    "    unsigned long long bits;\n" \
+    "    memcpy(&bits, &value, sizeof bits);\n" \
+    "    return bits;\n" \
+    "}\n\n" \
+    "unsigned long long memoHash(const unsigned long long *key, int length) {\n" \
+    "    unsigned long long hash = 14695981039346656037ULL;\n" \
+    "    for (int i = 0; i < length; i++) {\n" \
+    "        hash = (hash ^ key[i]) * 1099511628211ULL;\n" \
+    "        hash ^= hash >> 29;\n" \
+    "    }\n" \
+    "    return hash;\n" \
+    "}\n\n" \
+    "int memoSame(const unsigned long long *a, const unsigned long long *b, int length) {\n" \
+    "    return memcmp(a, b, sizeof *a * length) == 0;\n" \
+    "}\n\n" \
+    "void memoCopy(unsigned long long *to, const unsigned long long *from, int length) {\n" \
+    "    memcpy(to, from, sizeof *to * length);\n" \
+    "}\n\n"
+
+// a memoized function's body becomes name_f_body, and name_f looks its arguments up in a fixed size open addressed
+// table first. the body's own calls go through name_f, so recursion fills the table too. the wrapper's own locals
+// and the helpers it calls have a '_' or a capital in their names, so no ML parameter can hide them
+void emitMemoWrapper(const IrBlock *block) {
+    const char *name = symName(block->symbol);
+    const uint32_t *params = irListItems(block->params);
+    uint32_t keyLength = irListLength(block->params) ? irListLength(block->params) : 1;
+
+    addFormatToCodeBuffer("struct { unsigned long long key[%u]; double value; int used; } %s_memo[MEMO_SLOTS];\n\n", keyLength, name);
+    emitSignature(block, "");
+    addFormatToCodeBuffer(" {\n    unsigned long long memo_key[%u] = { ", keyLength);
+    for (uint32_t i = 0; i < irListLength(block->params); i++) {
+        addFormatToCodeBuffer(i > 0 ? ", memoBits(%s_p)" : "memoBits(%s_p)", symName((int32_t)params[i]));
+    }
+    if (!irListLength(block->params)) {
+        addCharToCodeBuffer('0');
+    }
+    addFormatToCodeBuffer(" };\n"
+        "    unsigned long long memo_first = memoHash(memo_key, %u) & (MEMO_SLOTS - 1);\n"
+        "    unsigned long long memo_slot = memo_first;\n"
+        "    for (int memo_probe = 0; memo_probe < MEMO_PROBES && %s_memo[memo_slot].used; memo_probe++, memo_slot = (memo_slot + 1) & (MEMO_SLOTS - 1)) {\n"
+        "        if (memoSame(%s_memo[memo_slot].key, memo_key, %u)) {\n"
+        "            return %s_memo[memo_slot].value;\n"
+        "        }\n"
+        "    }\n"
+        "    if (%s_memo[memo_slot].used) {\n"
+        "        memo_slot = memo_first;\n"
+        "    }\n"
+        "    double memo_value = %s_f_body(", keyLength, name, name, keyLength, name, name, name);
+    for (uint32_t i = 0; i < irListLength(block->params); i++) {
+        addFormatToCodeBuffer(i > 0 ? ", %s_p" : "%s_p", symName((int32_t)params[i]));
+    }
+    addFormatToCodeBuffer(");\n"
+        "    memoCopy(%s_memo[memo_slot].key, memo_key, %u);\n"
+        "    %s_memo[memo_slot].value = memo_value;\n"
+        "    %s_memo[memo_slot].used = 1;\n"
+        "    return memo_value;\n"
+        "}\n\n", name, keyLength, name, name);
+}
+
+// one C statement for every instruction that does something
+void emitBlock(const IrBlock *block) {
+    bool returned = false;
+    for (uint32_t value = block->first; value < block->first + block->count; value++) {
+        switch (Ir.op[value]) {
+            case IrAdd:
+            case IrSub:
+            case IrMul:
+            case IrDiv:
+                addToCodeBuffer("double ");
+                emitValue(value);
+                addToCodeBuffer(" = ");
+                emitValue(Ir.a[value]);
+                addCharToCodeBuffer(irOperatorChar(Ir.op[value]));
+                emitValue(Ir.b[value]);
+                addToCodeBuffer(";\n");
+                break;
+
+            case IrCall: {
+                if (Ir.type[value] != TypeNone) {
+                    addToCodeBuffer("double ");
+                    emitValue(value);
+                    addToCodeBuffer(" = ");
+                }
+                addFormatToCodeBuffer("%s_f(", symName(Ir.sym[value]));
+                const uint32_t *args = irListItems(Ir.a[value]);
+                for (uint32_t i = 0; i < irListLength(Ir.a[value]); i++) {
+                    if (i > 0) {
+                        addCharToCodeBuffer(',');
+                    }
+                    emitValue(args[i]);
+                }
+                addToCodeBuffer(");\n");
+                break;
+            }
+
+            case IrPrint:
+                addToCodeBuffer(Ir.type[Ir.a[value]] == TypeWhole ? "printf(\"%.0f\\n\", " : "printReal(");
+                emitValue(Ir.a[value]);
+                addToCodeBuffer(");\n");
+                break;
+
+            case IrReturn:
+                addToCodeBuffer("return ");
+                emitValue(Ir.a[value]);
+                addToCodeBuffer(";\n");
+                returned = true;
+                break;
+
+            default: // constants, arguments and parameters are written where they're used
+                break;
+        }
+    }
+    if (!block->symbol && !returned) {
+        addToCodeBuffer("    return 0;\n");
+    }
+}
+
+// defining translation to rudimentaty C program, works on the IR
+void toC() {
+    bool printsReal = false;
+    bool *usesArg = zeroedArray(SymbolCount + 1, sizeof(bool));
+    int32_t *args = resizeArray(NULL, SymbolCount + 1, sizeof(int32_t));
+    int argCount = 0;
+    for (int b = 0; b < BlockCount; b++) {
+        if (Blocks[b].removed) {
+            continue;
+        }
+        for (uint32_t value = Blocks[b].first; value < Blocks[b].first + Blocks[b].count; value++) {
+            if (Ir.op[value] == IrPrint && Ir.type[Ir.a[value]] == TypeReal) {
+                printsReal = true;
+            } else if (Ir.op[value] == IrArg && !usesArg[Ir.sym[value]]) {
+                usesArg[Ir.sym[value]] = true;
+                args[argCount++] = Ir.sym[value];
+            }
+        }
+    }
+
+    bool memoizes = false;
+    for (int b = 1; b < BlockCount; b++) {
+        memoizes |= Blocks[b].memoized;
+    }
+
+    addToCodeBuffer("#include <stdio.h>\n");
+    if (argCount) {
+        addToCodeBuffer("#include <stdlib.h>\n");
+    }
+    if (memoizes) {
+        addToCodeBuffer("#include <string.h>\n");
+    }
+    addCharToCodeBuffer('\n');
+
+    // printing something that might not be whole has to look at the value to pick the format
+    if (printsReal) {
+        addToCodeBuffer(PRINT_REAL_FUNCTION);
+    }
+    if (memoizes) {
+        addToCodeBuffer(MEMO_FUNCTIONS);
+    }
+
+    // argN are the only variables at file scope, every function can read them
+    for (int i = 0; i < argCount; i++) {
+        addFormatToCodeBuffer("double %s;\n", symName(args[i]));
+    }
+
+    // declare every function first so they can be defined in any order
+    for (int b = 1; b < BlockCount; b++) {
+        if (!Blocks[b].removed) {
+            emitSignature(&Blocks[b], "");
+            addToCodeBuffer(";\n");
+        }
+    }
+    addCharToCodeBuffer('\n');
+    for (int b = 1; b < BlockCount; b++) {
+        if (Blocks[b].removed) {
+            continue;
+        }
+        emitSignature(&Blocks[b], Blocks[b].memoized ? "_body" : "");
+        addToCodeBuffer(" {\n");
+        emitBlock(&Blocks[b]);
+        addToCodeBuffer("}\n\n");
+        if (Blocks[b].memoized) {
+            emitMemoWrapper(&Blocks[b]);
+        }
+    }
+
+    // add main functions
+    addToCodeBuffer("int main(int argCount, char *argValues[]) {\n"); // names no ML identifier can take
+    for (int i = 0; i < argCount; i++) {
+        int n = atoi(symName(args[i]) + 3) + 1; // arg0 is the first argument after the program
+        addFormatToCodeBuffer("%s = argCount > %d ? atof(argValues[%d]) : 0.0;\n", symName(args[i]), n, n);
+    }
+    if (!argCount) {
+        addToCodeBuffer("(void)argCount; (void)argValues;\n");
+    }
+    emitBlock(&Blocks[0]);
+    addToCodeBuffer("}\n");
+
+    free(usesArg);
+    free(args);
 }
 
 // ###################################### RUNNING C PROGRAM START ######################################
@@ -1401,9 +3541,35 @@ void parseCommandLineArgs(int argc, char *argv[]) {
 }
 
 int main(int argc, char *argv[]) {
+    // --check only validates the program, it never gets as far as gcc
+    // --jobs N lexes big files on N threads, 0 means one per CPU
+    // --fast-math lets folding assume no nan, infinity or -0 turns up, --stats reports what the optimiser did
+    // --memoize caches the results of every pure function, not just the ones that call themselves a lot
+    int argStart = 1;
+    bool badOption = false;
+    while (argStart < argc && strncmp(argv[argStart], "--", 2) == 0) {
+        if (strcmp(argv[argStart], "--check") == 0) {
+            CheckMode = true;
+        } else if (strcmp(argv[argStart], "--fast-math") == 0) {
+            FastMath = true;
+        } else if (strcmp(argv[argStart], "--memoize") == 0) {
+            MemoizeAll = true;
+        } else if (strcmp(argv[argStart], "--stats") == 0) {
+            ShowStats = true;
+        } else if (strcmp(argv[argStart], "--jobs") == 0 && argStart + 1 < argc) {
+            LexJobs = atoi(argv[++argStart]);
+            if (LexJobs <= 0) {
+                LexJobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+            }
+        } else {
+            badOption = true;
+        }
+        argStart++;
+    }
+
     // error checking, if no. of args is less than 2 
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <filename.ml>\n", argv[0]); // changed to fprintf to print to stderr instead of default data stream
+    if (badOption || argc - argStart < 1) {
+        fprintf(stderr, "Usage: %s [--check] [--jobs N] [--fast-math] [--memoize] [--stats] <filename.ml> [args...]\n", argv[0]); // changed to fprintf to print to stderr instead of default data stream
         return 1;
     }
 
@@ -1411,7 +3577,7 @@ int main(int argc, char *argv[]) {
     initBuffer();
 
     // the name of the file is at initial argument provided
-    char *filename = argv[1];
+    char *filename = argv[argStart];
 
     // checks if file name is .ml
     size_t length = strlen(filename); // unsigned datatype, good for storing str length 
@@ -1421,26 +3587,35 @@ int main(int argc, char *argv[]) {
     }
 
     // read the file
-    int status = readFile(filename); // also doing tokenisation
+    int status = readFile(filename); // tokens are lexed from it while parsing
 
     if (status == -1) {
         return 1;
     }
-    pCurrentTknIndex = 0;
+    lexInParallel(LexJobs);
+    initTokenStream();
 
     // Parse the code and build the AST
     AstNode* result = pProgram(); 
-    if (result != NULL) {
-
-        // Convert the AST to C code
-        toC(result);
-        
-        conductAssiReplace(codeBuffer);
+    if (CheckMode) {
+        // every error has been reported by now, nothing more to do
+    }
+    else if (result != NULL) {
+
+        // Convert the AST to C code, via the flat copy of the tree
+        uint32_t root = flattenAst(result);
+        inferTypes();
+        buildIr(root);
+        optimiseIr();
+        toC();
+        if (ShowStats) {
+            printStats();
+        }
 
         // Write the generated C code to a file
         FILE *cFile = fopen("mlProgram.c", "w");
         if (cFile != NULL) {
-            fputs(outBuff, cFile);
+            fwrite(codeBuffer, 1, bufferLength, cFile);
             fclose(cFile);
         } else {
             fprintf(stderr, "@ ERROR: Error writing C file.\n");
@@ -1451,11 +3626,25 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "@ ERROR: Test failed!\n");
     }
     
-    compileAndRunInC();
-    cleanupAfterExec();
+    if (!CheckMode) {
+        compileAndRunInC();
+        cleanupAfterExec();
+    }
     
     // Free the buffer memory
     freeBuffer();
-
-    return 0;
+    releaseSource();
+    freeLexChunks();
+    freeSymbols();
+    free(Scratch);
+    free(ParamScratch);
+    free(OperStack);
+    free(Functions);
+    arenaFree(&CompileArena);
+    freeFlatAst();
+    freeIr();
+    free(InlinedCalls);
+    free(SpecialisedCalls);
+
+    return SyntaxErrorCount ? 1 : 0;
 }